@@ -0,0 +1,144 @@
+///
+/// \file communicator.hpp
+/// \brief 进程间传递参数导数
+///
+
+#ifndef COMMUNICATOR_H_
+#define COMMUNICATOR_H_
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define TCP_BASE_PORT 23456   ///>rank号进程监听TCP_BASE_PORT+rank端口
+
+using namespace std;
+
+/// \brief 进程间集合通信的接口，数据都在主机内存上，所有进程必须按相同顺序调用
+///
+class Communicator {
+
+public:
+	Communicator();
+	virtual ~Communicator();
+
+	/// \brief fork出num_process-1个子进程，返回当前进程的rank
+	int forkProcesses();
+	/// \brief 0号进程等待所有子进程结束
+	void waitProcesses();
+
+	/// \brief fork之后每个进程调用一次，建立连接
+	virtual void init() {}
+
+	/// \brief 所有进程的data逐元素求和，结果写回每个进程的data
+	virtual void allReduce(float* data, const int len) = 0;
+
+	/// \brief 0号进程的data拷贝到其他进程
+	virtual void broadcast(float* data, const int len) = 0;
+
+	/// \brief data分成num_process段，第r段是[starts[r], starts[r+1])，
+	/// 返回时本进程那一段是所有进程这一段的和，其他段的内容不确定
+	virtual void reduceScatter(float* data, const vector<int>& starts) = 0;
+
+	/// \brief 每个进程把自己那一段发给其他进程，段的划分和reduceScatter相同
+	virtual void allGather(float* data, const vector<int>& starts) = 0;
+
+	virtual void barrier() = 0;
+
+	/// \brief 在后台线程里按提交顺序执行allReduce，立即返回，
+	/// 完成之前不能在别的线程上调用其他集合通信
+	void allReduceAsync(float* data, const int len);
+	/// \brief 等待之前提交的allReduceAsync全部完成
+	void waitAll();
+
+	inline int getRank() {
+		return _rank;
+	}
+	inline int getNumProcess() {
+		return _num_process;
+	}
+
+protected:
+	int _rank;
+	int _num_process;
+	vector<pid_t> _children;
+
+private:
+	static void* runAsync(void* comm);
+
+	pthread_t _async_thread;
+	bool _is_async_started;   ///>后台线程在第一次提交时才创建，保证在fork之后
+	bool _is_stop;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	deque< pair<float*, int> > _queue;
+	int _num_pending;   ///>已提交但还没完成的个数
+};
+
+/// \brief 同一台机器上fork出来的进程通过共享内存通信
+///
+/// 每个进程在共享内存里有一个槽，allreduce分两步：每个进程只负责把所有槽里
+/// 自己那一段加起来(reduce-scatter)，然后每个进程把结果整段读回(allgather)，
+/// 每个进程读写的数据量和ring allreduce相同，但只需要两次barrier
+class ShmCommunicator : public Communicator {
+
+public:
+	/// \brief 必须在fork之前、初始化cuda之前创建
+	ShmCommunicator(const int num_process);
+	~ShmCommunicator();
+
+	void allReduce(float* data, const int len);
+	void broadcast(float* data, const int len);
+	void reduceScatter(float* data, const vector<int>& starts);
+	void allGather(float* data, const vector<int>& starts);
+	void barrier();
+
+private:
+	/// \brief 保证共享的数据区能放下len个元素，所有进程必须同时调用
+	void reserve(const int len);
+
+	struct ShmHeader {
+		pthread_barrier_t barrier;
+	};
+
+	ShmHeader* _header;   ///>fork之前创建的匿名共享内存，存放跨进程的barrier
+	float* _slots;   ///>num_process个槽加上一段结果
+	int _capacity;   ///>每个槽能存放的元素个数
+	pid_t _launcher_pid;
+};
+
+/// \brief 进程首尾相连成环，每个进程只和前后两个进程通过TCP通信
+///
+/// hosts[i]是i号进程所在机器的地址，单机测试时全部是127.0.0.1
+class TcpCommunicator : public Communicator {
+
+public:
+	TcpCommunicator(const int num_process, const vector<string>& hosts, \
+			const int base_port = TCP_BASE_PORT);
+	~TcpCommunicator();
+
+	void init();
+	void allReduce(float* data, const int len);
+	void broadcast(float* data, const int len);
+	void reduceScatter(float* data, const vector<int>& starts);
+	void allGather(float* data, const vector<int>& starts);
+	void barrier();
+
+private:
+	/// \brief 同时向下一个进程发送、从上一个进程接收，避免两边都阻塞在发送上
+	void sendRecv(const float* send_data, const int send_len, \
+			float* recv_data, const int recv_len);
+
+	vector<string> _hosts;
+	int _base_port;
+	int _next_fd;   ///>发往rank+1
+	int _prev_fd;   ///>来自rank-1
+	vector<float> _recv_buf;
+};
+
+#include "../src/communicator.cpp"
+
+#endif
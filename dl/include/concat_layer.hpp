@@ -0,0 +1,34 @@
+///
+/// \file concat_layer.hpp
+/// @brief 实现了按channel拼接几个输入
+
+#ifndef CONCAT_LAYER_H_
+#define CONCAT_LAYER_H_
+
+#include <iostream>
+#include "layer.hpp"
+
+/// \brief 每张图片的数据按channel、行、列存放，按channel拼接就是把每张图片的
+/// 几段输入首尾相连
+template <typename Dtype>
+class ConcatLayer : public Layer<Dtype> {
+
+public:
+	
+	ConcatLayer(ConcatParam* cp);
+	~ConcatLayer();
+
+	void initCuda();
+	void computeOutput(Matrix<Dtype>* x);
+	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
+	void computeMultiOutput(const vector<Matrix<Dtype>*>& xs);
+	void computeMultiDerivsOfInput(const vector<Matrix<Dtype>*>& dE_dxs);
+
+private:
+	ConcatParam* _cp;
+	vector<int> _offsets;   ///>第i个输入在一张图片输出中的起点
+};
+
+
+#include "../src/concat_layer.cu"
+#endif
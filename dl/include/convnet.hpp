@@ -6,31 +6,60 @@
 #define CONVNET_H_
 
 #include <iostream>
+#include <map>
+#include <string>
 #include <cudnn.h>
 #include "layer.hpp"
 
+#define IM2COL_MAX_LEN 8388608   ///>im2col展开矩阵最多的元素个数，超过时分几批图片计算
+
+/// \brief 卷积算法的计时结果，按层的形状和设备名保存在文件里，每行是算法和key
+class ConvAlgoCache {
+
+public:
+	/// \brief 在第一次查找之前调用，空字符串表示不使用文件
+	static void setFile(const string& file);
+	/// \brief 没有记录时返回CONV_AUTO
+	static ConvAlgo find(const string& key);
+	static void save(const string& key, const ConvAlgo algo);
+
+private:
+	static void load();
+
+	static string _file;
+	static bool _is_loaded;
+	static map<string, ConvAlgo> _algos;
+};
+
 
 template <typename Dtype>
 class ConvNet : public TrainLayer<Dtype>{
 
 private:
 
-	Matrix<Dtype>* unfold_dE_db_tmp;
-	Matrix<Dtype>* dE_db_tmp;
-	Matrix<Dtype>* padded_x;
-	Matrix<Dtype>* unfold_x;
-
-	Matrix<Dtype>* unranged_dE_dx;
-	Matrix<Dtype>* unranged_dE_dw;
 	int _filt_pixs;
 	int _conv_pixs;
-	int _padded_in_pixs;
 	int _in_pixs;
 	int _box_in_pixs;
 	int _num_box;
+	int _max_box_side;   ///>设备每个block的线程数允许的最大box边长
+	size_t _sh_mem_budget;   ///>一个block可以使用的共享内存
+	int _backward_thread;   ///>计算输入导数时每个block的线程数
+	ConvAlgo _algo;   ///>前向使用的算法
+	Matrix<Dtype>* _col;   ///>im2col时_col_imgs张图片的展开矩阵
+	int _col_imgs;
+	bool _is_fuse_relu;   ///>后面的relu层合并进来，写入的_y已经求过relu
 	
 	ConvParam* _cp;
 
+	void chooseBoxSize();
+	void setBoxSide(const int box_side);
+	void chooseAlgo();
+	void createCol();
+	string getAlgoKey();
+	void computeOutputDirect(Matrix<Dtype>* x);
+	void computeOutputIm2col(Matrix<Dtype>* x);
+
 public:
 	ConvNet(ConvParam* cp);
 	~ConvNet();
@@ -39,6 +68,20 @@ public:
 	void computeOutput(Matrix<Dtype>* x);
 	void computeDerivsOfPars(Matrix<Dtype>* x);
 	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
+
+	inline void setFuseRelu(const bool is_fuse_relu) {
+		_is_fuse_relu = is_fuse_relu;
+	}
+
+	///> 直接卷积时前向的配置是box边长，从最大边长开始每次减半，反向的配置是线程数
+	int getNumForwardConfig();
+	void setForwardConfig(const int idx);
+	int getNumBackwardConfig() {
+		return this->getNumThreadConfig();
+	}
+	void setBackwardConfig(const int idx) {
+		_backward_thread = this->getConfigThread(idx);
+	}
 	
 };
 
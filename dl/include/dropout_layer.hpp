@@ -6,7 +6,6 @@
 #define DROPOUT_LAYER_H_
 
 #include <iostream>
-#include <curand.h>
 #include "layer.hpp"
 
 template <typename Dtype>
@@ -21,11 +20,21 @@ public:
 	void computeOutput(Matrix<Dtype>* x);
 	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
 
+	/// \brief key由层号、worker号和进程号混合得到，不同层、副本和进程的
+	/// 随机数互相独立。混合是一一映射，不同的组合一定得到不同的key
+	inline void setSeed(const int layer_idx, const int worker_idx, const int rank){
+		unsigned long long key = ((unsigned long long)rank << 40) \
+			^ ((unsigned long long)worker_idx << 20) ^ (unsigned long long)layer_idx;
+		key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+		_seed = key ^ (key >> 31);
+	}
+
 private:
 	Param* _p;
 	Matrix<int> *_drop_record;  ///>记录该点是否被丢弃
-	Matrix<curandState> *_drop_rand_probs; ///>记录该点被丢弃的概率，与0.5比较
-	bool _is_set_up;  ///>随机数初始化
+	unsigned long long _seed;  ///>Philox的key
+	unsigned long long _step;  ///>每次前向加1，作为Philox计数器的一部分
 };
 
 
@@ -0,0 +1,31 @@
+///
+/// \file eltwise_layer.hpp
+/// @brief 实现了几个输入逐点相加，用于残差连接
+
+#ifndef ELTWISE_LAYER_H_
+#define ELTWISE_LAYER_H_
+
+#include <iostream>
+#include "layer.hpp"
+
+template <typename Dtype>
+class EltwiseSumLayer : public Layer<Dtype> {
+
+public:
+	
+	EltwiseSumLayer(Param* fcp);
+	~EltwiseSumLayer();
+
+	void initCuda();
+	void computeOutput(Matrix<Dtype>* x);
+	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
+	void computeMultiOutput(const vector<Matrix<Dtype>*>& xs);
+	void computeMultiDerivsOfInput(const vector<Matrix<Dtype>*>& dE_dxs);
+
+private:
+	Param* _fcp;
+};
+
+
+#include "../src/eltwise_layer.cu"
+#endif
@@ -0,0 +1,164 @@
+///
+/// \file engine.hpp
+/// \brief 整个程序共享的执行环境：主机上的work-stealing线程池、每个线程的cublas句柄
+/// 和numa拓扑
+///
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <pthread.h>
+#include "cublas_v2.h"
+
+#define HOST_GRAIN_SIZE 32768   ///>主机上逐元素的循环每段至少这么多个元素
+
+using namespace std;
+
+/// \brief 处理[begin, end)，arg是调用者传进来的上下文
+typedef void (*RangeFunc)(void* arg, const int begin, const int end);
+typedef void (*TaskFunc)(void* arg);
+
+/// \brief 有依赖关系的一组任务，一个任务在它依赖的任务都完成以后才开始
+///
+/// 任务在Engine::run里执行，执行完以后可以重新run，每个任务只执行一次
+class TaskGraph {
+
+public:
+	/// \brief 返回任务编号，deps里是已经加入的任务编号
+	int addTask(TaskFunc func, void* arg, const vector<int>& deps = vector<int>());
+
+private:
+	friend class Engine;
+
+	struct Node {
+		TaskFunc func;
+		void* arg;
+		TaskGraph* graph;
+		int num_deps;
+		int num_pending;   ///>还没完成的依赖个数，run时从num_deps开始递减
+		vector<int> successors;
+	};
+
+	vector<Node> _nodes;
+	volatile int _num_remain;   ///>还没完成的任务个数
+};
+
+/// \brief 单例，线程在第一次提交任务时才创建，保证在fork之后
+///
+/// 每个线程有自己的双端队列，从尾部放入和取出自己的任务，空闲时从其他线程队列的
+/// 头部偷任务。不在池里的线程(主线程、参数导数线程等)提交的任务放进一个公共队列。
+/// 等待任务完成的线程不会阻塞，而是继续执行队列里的任务，所以在任务里再调用
+/// parallelFor或者run不会死锁，也不会创建更多线程
+class Engine {
+
+public:
+	static Engine* getInstance();
+
+	/// \brief 在第一次使用之前调用，num_thread是池里的线程数，不包括调用线程，
+	/// 0表示使用所有核
+	static void setNumThread(const int num_thread);
+
+	/// \brief 在第一次使用之前调用。node是本进程的线程和主机缓存所在的numa节点，
+	/// -1表示使用gpu所在的节点；node_cpus是每个节点的核，为空时从/sys读取
+	static void setNuma(const bool is_pin, const int node, \
+			const vector< vector<int> >& node_cpus);
+
+	/// \brief 调用线程自己的cublas句柄，第一次调用时创建，使用cudaStreamPerThread，
+	/// 不同线程上的层计算互不干扰
+	static cublasHandle_t getCublasHandle();
+
+	inline int getNumThread() {
+		return _num_thread;
+	}
+	inline int getNumNode() {
+		return _node_cpus.size();
+	}
+	/// \brief 本进程所在的节点，-1表示不区分节点
+	inline int getNode() {
+		return _node;
+	}
+
+	/// \brief 把调用线程绑定到本进程所在节点的核上，worker、流水线段和参数导数线程
+	/// 开始时调用，不再跨socket迁移
+	void pinThread();
+
+	/// \brief 在本进程所在节点上分配主机缓存，用freeHost释放。先用mbind指定节点，
+	/// 再由绑定在该节点上的池线程并行写一遍，mbind不可用时按first-touch落在同一节点
+	void* allocHost(const size_t size);
+	void freeHost(void* ptr);
+
+	/// \brief 把[begin, end)按grain切成几段并行执行func，全部完成后返回，
+	/// 调用线程也执行其中一段
+	void parallelFor(const int begin, const int end, const int grain, \
+			RangeFunc func, void* arg);
+
+	/// \brief 执行graph里的所有任务，全部完成后返回
+	void run(TaskGraph* graph);
+
+	~Engine();
+
+private:
+	Engine(const int num_thread);
+
+	struct Task {
+		TaskFunc func;
+		void* arg;
+	};
+	struct WorkQueue {
+		pthread_mutex_t mutex;
+		deque<Task> tasks;
+	};
+	struct RangeTask {
+		RangeFunc func;
+		void* arg;
+		int begin;
+		int end;
+		volatile int* num_remain;
+	};
+
+	static void* runWorker(void* engine);
+	static void runRange(void* range_task);
+	static void runNode(void* node);
+
+	void start();
+	void workerLoop(const int idx);
+	void readTopology();
+	/// \brief gpu所在的numa节点，读不到时是-1
+	int getDeviceNode();
+	static void parseCpuList(const string& list, vector<int>& cpus);
+	static void touchRange(void* ptr, const int begin, const int end);
+	void push(const Task& task);
+	bool pop(Task& task);
+	/// \brief 等num_remain变成0，期间执行队列里的任务
+	void helpUntil(volatile int* num_remain);
+
+	int _num_thread;
+	bool _is_started;
+	bool _is_stop;
+	vector<pthread_t> _threads;
+	vector<WorkQueue*> _queues;   ///>每个线程一个，最后一个是池外线程提交的公共队列
+	volatile int _num_queued;   ///>所有队列里的任务数，空闲线程据此睡眠
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+
+	pthread_mutex_t _handle_mutex;
+	vector<cublasHandle_t> _handles;
+
+	//numa，池线程依次绑定到_pin_cpus的一个核上
+	bool _is_pin;
+	int _node;
+	vector< vector<int> > _node_cpus;
+	vector<int> _pin_cpus;   ///>本进程可以使用的核，不区分节点时各节点交替排列
+
+	static int _init_num_thread;
+	static bool _init_is_pin;
+	static int _init_node;
+	static vector< vector<int> > _init_node_cpus;
+};
+
+#include "../src/engine.cpp"
+
+#endif
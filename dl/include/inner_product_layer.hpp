@@ -8,6 +8,7 @@
 #include <iostream>
 #include "layer.hpp"
 #include "layer_kernel.cuh"
+#include "communicator.hpp"
 
 template <typename Dtype>
 class InnerProductLayer : public TrainLayer<Dtype> {
@@ -22,10 +23,31 @@ public:
 	void computeDerivsOfPars(Matrix<Dtype>* x);
 	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
 
+	/// \brief w按列切分时，进程之间拼接输出、累加输入导数
+	void setCommunicator(Communicator* comm) {
+		_comm = comm;
+	}
+
 private:
 	InnerParam* _fcp;
 	Matrix<Dtype>* data_T;
 	Matrix<Dtype>* w_T;
+
+	//w按列切分到各进程，_w、_bias和导数只有本进程的几列，_y和_dE_dy是完整的。
+	//本进程的输出直接写进_y的对应列，再和其他进程的列allgather；
+	//输入导数是各进程部分和，allreduce以后才完整
+	Communicator* _comm;
+	Matrix<Dtype>* _ones;   ///>长度为minibatch的全1向量，加bias和对bias求导用
+	Dtype* _h_y;   ///>所有进程的输出，按进程连续存放，每段是minibatch行本进程的列
+	Dtype* _h_dE_dx;
+	vector<int> _gather_starts;
+
+	inline bool isSharded() {
+		return _fcp->getNumShard() > 1;
+	}
+	void computeShardOutput(Matrix<Dtype>* x);
+	void computeShardDerivsOfPars(Matrix<Dtype>* x);
+	void computeShardDerivsOfInput(Matrix<Dtype>* dE_dx);
 };
 
 #include "../src/inner_product_layer.cu"
@@ -4,10 +4,12 @@
 #ifndef LAYER_HPP_
 #define LAYER_HPP_
 
+#include <vector>
 #include <cuda_runtime.h>
 #include "utils.cuh"
 #include "param.h"
 #include "matrix.hpp"
+#include "engine.hpp"
 
 template <typename Dtype>
 class Layer {
@@ -21,6 +23,52 @@ public:
 
 	virtual void computeDerivsOfInput(Matrix<Dtype>* dE_dx) {}
 
+	/// \brief 有几个输入的层(ELTWISE_SUM、CONCAT)重写，其他层只有第一个输入
+	virtual void computeMultiOutput(const vector<Matrix<Dtype>*>& xs) {
+		computeOutput(xs[0]);
+	}
+	/// \brief dE_dxs中为空的是数据，不需要计算导数
+	virtual void computeMultiDerivsOfInput(const vector<Matrix<Dtype>*>& dE_dxs) {
+		if (dE_dxs[0] != NULL)
+			computeDerivsOfInput(dE_dxs[0]);
+	}
+
+	/// \brief autotune时可以选择的前向配置个数，0表示没有可调的配置
+	virtual int getNumForwardConfig() {
+		return 0;
+	}
+	/// \brief 使用第idx个前向配置，层参数里已经有autotune结果时在构造时使用
+	virtual void setForwardConfig(const int idx) {}
+	virtual int getNumBackwardConfig() {
+		return 0;
+	}
+	virtual void setBackwardConfig(const int idx) {}
+
+	/// \brief dE_dx为空时是执行一次前向的平均时间(毫秒)，否则是计算一次输入导数的，
+	/// 先执行一次排除第一次启动的开销
+	float timeComputation(Matrix<Dtype>* x, Matrix<Dtype>* dE_dx) {
+		cudaEvent_t start, stop;
+		cudaEventCreate(&start);
+		cudaEventCreate(&stop);
+
+		for (int r = 0; r <= AUTOTUNE_REPEAT; ++r) {
+			if (r == 1)
+				cudaEventRecord(start, cudaStreamPerThread);
+			if (dE_dx == NULL)
+				computeOutput(x);
+			else
+				computeDerivsOfInput(dE_dx);
+		}
+		cudaEventRecord(stop, cudaStreamPerThread);
+		cudaEventSynchronize(stop);
+
+		float elapsed;
+		cudaEventElapsedTime(&elapsed, start, stop);
+		cudaEventDestroy(start);
+		cudaEventDestroy(stop);
+		return elapsed / AUTOTUNE_REPEAT;
+	}
+
 	inline Matrix<Dtype>* getY() {
 		return _y;
 	}   
@@ -29,7 +77,22 @@ public:
 	}
 
 protected:
-	cublasHandle_t handle;
+	/// \brief 第idx个线程数配置，从MIN_NUM_THREAD开始翻倍
+	static inline int getConfigThread(const int idx) {
+		return MIN_NUM_THREAD << idx;
+	}
+	static inline int getNumThreadConfig() {
+		int num_config = 0;
+		while ((MIN_NUM_THREAD << num_config) <= MAX_NUM_THREAD)
+			num_config++;
+		return num_config;
+	}
+	/// \brief 每个线程循环处理多个元素的kernel的block个数
+	static inline int getNumBlock(const int num_kernel, const int num_thread) {
+		return MAX_NUM_KERNEL < (num_kernel / num_thread + 1) \
+			? MAX_NUM_KERNEL : (num_kernel / num_thread + 1);
+	}
+
 	Matrix<Dtype>* _y;    ///>每一层的输出
 	Matrix<Dtype>* _dE_dy;   ///>每层输出的导数
 };
@@ -46,20 +109,13 @@ public:
 
 	virtual void computeDerivsOfPars(Matrix<Dtype>* x) {}
 
-	void updatePars(bool isShow = false) {
-		if(isShow == true){
-			_w->showValue("w");
-			_dE_dw->showValue("dEdw");
-			cout << _tp->getMomentum() << ":" << _tp->getWeightDecay() << ":" \
-				<< _tp->getWLR() << ":" << _tp->getBiasLR() << endl; 
-		}
-		_w_inc->addSum(_w, _dE_dw, _tp->getMomentum(), -_tp->getWeightDecay(), \
-			            -_tp->getWLR() / _tp->getMinibatchSize());
-		_w->add(_w_inc, 1, 1);
-
-		_bias_inc->add(_dE_db, _tp->getMomentum(), \
-				-_tp->getBiasLR() / _tp->getMinibatchSize());
-		_bias->add(_bias_inc, 1, 1);
+	/// \brief 改为使用ModelComponent中连续存放的参数和导数，释放原来的显存，
+	/// 动量等状态由Optimizer保存
+	void bindPars(Dtype* w, Dtype* bias, Dtype* dE_dw, Dtype* dE_db) {
+		_w = rebind(_w, w);
+		_bias = rebind(_bias, bias);
+		_dE_dw = rebind(_dE_dw, dE_dw);
+		_dE_db = rebind(_dE_db, dE_db);
 	}
 	inline Matrix<Dtype>* getW() {
 		return _w;
@@ -67,12 +123,26 @@ public:
 	inline Matrix<Dtype>* getBias() {
 		return _bias;
 	}
+	inline Matrix<Dtype>* getDEDW() {
+		return _dE_dw;
+	}
+	inline Matrix<Dtype>* getDEDB() {
+		return _dE_db;
+	}
+	inline TrainParam* getTrainParam() {
+		return _tp;
+	}
 
 protected:
+	static Matrix<Dtype>* rebind(Matrix<Dtype>* mat, Dtype* data) {
+		Matrix<Dtype>* view = new Matrix<Dtype>(data, mat->getNumRows(), \
+				mat->getNumCols());
+		delete mat;
+		return view;
+	}
+
 	Matrix<Dtype>* _w;
 	Matrix<Dtype>* _bias;
-	Matrix<Dtype>* _w_inc;
-	Matrix<Dtype>* _bias_inc;
 	Matrix<Dtype>* _dE_dw;
 	Matrix<Dtype>* _dE_db;
 
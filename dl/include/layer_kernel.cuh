@@ -12,110 +12,100 @@
 			i < (n); \
 			i += blockDim.x * gridDim.x)
 
+//求和规约时一个block的线程数，必须是2的次方
+#define REDUCE_BLOCK_SIZE 256
 
+
+/// \brief x是没有补零的输入，补零在载入共享内存时完成，is_relu时写入的是relu以后的值
 __global__ void forward_convolution(const float* x, const float* w, \
 		const float* bias, float* targets, \
 		const int in_height, const int in_width, const int in_channel, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, const int filter_channel, \
+		const int pad_height, const int pad_width, \
 		const int stride_height, const int stride_width, \
 		const int box_num_height, const int box_num_width, \
 		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width);
+		const int box_out_height, const int box_out_width, const bool is_relu);
 
 
-__global__ void backward_convolution(const float* dE_dy, const float *w, \
-		float* targets, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int out_channel, const int in_channel, \
+/// \brief 把num_img张图片展开成每张in_channel*filter_pixs行、out_pixs列的矩阵，
+/// 行的顺序和w中一个输出channel的排列相同，补零的位置填0。num_kernel是展开后的总个数
+__global__ void im2col(const float* x, float* col, const int num_kernel, \
+		const int in_height, const int in_width, const int in_channel, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width, \
-		const int box_num_height, const int box_num_width);
-
-
-__global__ void compute_convolution_derivs(const float* dE_dy, const float *x, \
-		float* dE_dw, const int box_out_height, const int box_out_width, \
-		const int out_channel, const int in_channel, const int in_height, \
-		const int in_width, const int out_height, const int out_width, \
-		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width, \
-		const int box_num_height, const int box_num_width);
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width);
 
+/// \brief targets每张图是out_channel行、out_pixs列，每行加上对应的bias，
+/// is_relu时再求relu
+__global__ void add_conv_bias(float* targets, const float* bias, \
+		const int num_kernel, const int out_pixs, const int out_channel, \
+		const bool is_relu);
 
-__global__ void compact_dervis_w(const float* unranged_dE_dw, \
-		float* dE_dw, const int filter_height, const int filter_width, \
-		const int box_num_height, const int box_num_width, \
-		const int minibatch_size, const int in_channel, const int out_channel);
+/// \brief y是relu以后的输出，y不大于0的位置dE_dy置0，原地计算
+__global__ void relu_mask_back(const float* y, float* dE_dy, const int num_kernel);
 
-__global__ void compute_derivs_of_bias(const float* dE_dy, float* targets, \
+/// \brief num_kernel是dE_dx的总个数，targets是没有补零的输入导数，每个位置都会被写入
+__global__ void backward_convolution(const float* dE_dy, const float *w, \
+		float* targets, const int num_kernel, \
+		const int in_height, const int in_width, const int in_channel, \
 		const int out_height, const int out_width, const int out_channel, \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width);
-
-
-__global__ void pad_to_ori(float* dst, const float* src, const int num_kernel, \
-		const int img_height, const int img_width, \
-		const int padded_img_height, const int padded_img_width, \
-		const int img_channel);
+		const int filter_height, const int filter_width, \
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width);
 
-__global__ void ori_to_padding(const float* src, float* dst, const int num_kernel, \
-		const int img_height, const int img_width, const int padded_img_height, \
-		const int padded_img_width, const int img_channel);
 
-__global__ void max_pooling(const float* convOutputs, float* targets, int* maxPoolPos, \
-		const int in_height, const int in_width, \
-		const int in_channels, const int out_height, const int out_width, \
+/// \brief grid为(in_channel*filter_pixs, out_channel)，block大小为REDUCE_BLOCK_SIZE
+/// 
+/// 直接写出dE_dw，占用的内存与minibatch无关
+__global__ void compute_convolution_derivs(const float* dE_dy, const float *x, \
+		float* dE_dw, const int minibatch_size, \
+		const int out_channel, const int in_channel, const int in_height, \
+		const int in_width, const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width);
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width);
+
+/// \brief grid为out_channel，block大小为REDUCE_BLOCK_SIZE
+__global__ void compute_derivs_of_bias(const float* dE_dy, float* dE_db, \
+		const int minibatch_size, const int out_pixs, const int out_channel);
+
+/// \brief maxPoolPos只记录窗口内的偏移(行*filter_width+列)，窗口不超过16*16
+/// num_kernel是输出的总个数，每个线程计算一个输出点
+__global__ void max_pooling(const float* convOutputs, float* targets, \
+		unsigned char* maxPoolPos, \
+		const int num_kernel, const int in_height, const int in_width, \
+		const int out_height, const int out_width, \
+		const int filter_height, const int filter_width, \
+		const int stride_height, const int stride_width);
 
 __global__ void avg_pooling(const float* convOutputs, float* targets, \
-		const int in_height, const int in_width, \
-		const int in_channels, const int out_height, const int out_width, \
+		const int num_kernel, const int in_height, const int in_width, \
+		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width);
+		const int stride_height, const int stride_width);
 
+/// \brief num_kernel是输入导数的总个数，dE_dx每个位置都会被写入
 __global__ void compute_dE_dy_max(const float* dE_dy_i, float* targets, \
-		int* maxPoolPos, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int num_filters, \
+		const unsigned char* maxPoolPos, const int num_kernel, \
+		const int in_height, const int in_width, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_num_height, const int box_num_width);
+		const int stride_height, const int stride_width);
 
 __global__ void compute_dE_dy_avg(const float* dE_dy_i, float* targets, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int num_filters, \
+		const int num_kernel, \
+		const int in_height, const int in_width, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_num_height, const int box_num_width);
+		const int stride_height, const int stride_width);
 
 __global__ void compute_dE_dy(const float* y_j, const int* labels, \
 		float* dE_dy_j, const int width);
 
 
-__global__ void compactOverlap(float* src, float* targets, \
-		const int in_height, const int in_width, const int in_channel, \
-		const int overlap_height, const int overlap_width, \
-		const int box_in_height, const int box_in_width, \
-		const int box_num_height, const int box_num_width);
-
-
-
-
-
-
-
-
 
 
 
@@ -26,6 +26,11 @@ public:
 		_d_record->copyFromHost(_h_record, this->_y->getNumCols() * this->_y->getNumCols());
 		return _d_record;
 	}
+	/// \brief 把另一个副本的分类记录累加进来
+	inline void mergeRecord(Logistic<Dtype>* other){
+		for(int i = 0; i < this->_y->getNumCols() * this->_y->getNumCols(); i++)
+			_h_record[i] += other->_h_record[i];
+	}
 	inline void setRecordToZero(){
 		memset(_h_record, 0, sizeof(int) * this->_y->getNumCols() * this->_y->getNumCols());
 	}
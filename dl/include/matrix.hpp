@@ -52,6 +52,9 @@ public:
 
     Matrix(const Matrix *like);
 
+    /// \brief 不分配显存，直接使用已有的数据，析构时不释放
+    Matrix(Dtype *data, int numRows, int numCols);
+
     ~Matrix();
     /// \brief 初始化类中成员，为行列赋值
 	
@@ -93,7 +96,7 @@ public:
     /// \param[in] b
     /// \param[out] target 两个矩阵相乘输出
     void rightMult(Matrix<Dtype> *b, float scale_AB, Matrix<Dtype> *target, \
-                cublasHandle_t &handle);
+                cublasHandle_t handle);
 
     /// \brief 将每一行累加起来生成一列，列个数保持不变
     /// \param[out] target
@@ -137,8 +140,10 @@ public:
 
 	void applyRelu(Matrix<Dtype>* target, Matrix<int>* record, bool direction = true);
 
+	/// \brief 以0.5的概率丢弃每一个值
+	/// \param[in] seed, step 和元素下标一起决定随机数，相同输入得到相同的mask
 	void applyDropout(Matrix<Dtype> *target, Matrix<int>* record, \
-		Matrix<curandState>* rand_probs, bool is_set_up);
+		const unsigned long long seed, const unsigned long long step);
 
     /// \brief 矩阵间点加
     ///
@@ -166,6 +171,7 @@ public:
 
 	void reValue(int value, bool is_div = false);
 
+    /// \brief 前len个元素的2范数，多个block并行归约
     Dtype computeNorm(int len);
 
     void cropMatToNew(Matrix<Dtype> *tar, const int row_start, const int cropped_height, \
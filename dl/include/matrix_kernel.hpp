@@ -45,12 +45,10 @@ template <typename Dtype>
 __global__ void kSigmoid(Dtype* gData, Dtype* target, const int width, \
 		const int height);
 
-template <typename Dtype>
-__global__ void kSetUpCurand(curandState *state, const int width, const int height);
-
 template <typename Dtype>
 __global__ void kDropout(Dtype* gData, Dtype* target, int* record, \
-		curandState *state, const int width, const int height);
+		const unsigned long long seed, const unsigned long long step, \
+		const int length);
 
 template <typename Dtype>
 __global__ void kRelu(Dtype* gData, Dtype* target, int* record, const int length);
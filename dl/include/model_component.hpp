@@ -41,6 +41,15 @@ private:
     int _img_width;
     int _img_channel;
     int _one_img_len;  ///>输入的一张图片的长度
+    int _num_worker;   ///>数据并行的线程数，minibatch被平均分给每个线程
+    bool _is_hogwild;   ///>每个线程训练完整的minibatch，不加锁直接更新共享的参数
+    int* _pars_version;   ///>hogwild时每个需要训练层被更新的次数，所有副本共享，也是adam的step
+    vector<int> _max_staleness;   ///>每个需要训练层允许的最大延迟，0表示不限制
+    int _num_stage;   ///>流水线的段数，大于1时每个worker是一个micro-batch
+    PipelineSchedule _pipeline_schedule;
+    bool _is_tensor_parallel;   ///>有w按列切分到各进程的层，所有进程训练相同的minibatch
+    bool _is_autotune;   ///>创建层时测每层前向和反向的几种线程配置，使用最快的
+    bool _is_fuse;   ///>卷积后面只被它使用的relu合并进卷积的前向kernel
 
     vector< Layer<Dtype>* > _layers;    ///>保存每个层的指针
     vector< Layer<Dtype>* > _layers_needed_train;
@@ -51,16 +60,34 @@ private:
     vector<float> _w_init_gauss;
     vector< Matrix<Dtype>* > _w; ///>保存需要训练层的权重指针
     vector< Matrix<Dtype>* > _bias;
+    vector< Matrix<Dtype>* > _dE_dw; ///>需要训练层的权重导数，进程间求平均
+    vector< Matrix<Dtype>* > _dE_db;
+
+    ///> 所有需要训练层的w和bias、导数分别连续存放，上面的矩阵都是其中一段，
+    ///> 动量等状态在Optimizer里按同样的布局存放。
+    ///> 按反向传播算完导数的顺序(从最后一层往前)排列，每段按PARS_ALIGN对齐
+    Matrix<Dtype>* _pars;
+    Matrix<Dtype>* _derivs;
+    vector<int> _w_offset;
+    vector<int> _bias_offset;
+    int _pars_len;   ///>补齐以后的总长度
 
     vector< Matrix<Dtype>* > _y;
     vector< Matrix<Dtype>* > _dE_dy;
     vector< Matrix<Dtype>* > _y_needed_train;
+    //静态图，层按依赖关系排好顺序，输入是之前任意层的输出
+    vector< vector<int> > _bottoms;   ///>每层输入在_y中的下标，0是数据，j+1是第j层的输出
+    vector< vector<bool> > _is_direct_derivs;   ///>输入导数直接写进dE_dy，否则先写临时矩阵再累加
+    vector< Matrix<Dtype>* > _dE_dy_scratch;   ///>按_y下标，被几层使用的tensor才有
 
     Matrix<Dtype>* _mini_data;  ///> 保存像素值
     Matrix<int>* _mini_label;   ///> 保存物体分类的类别
 
     map<string, LayerType> _string_map_layertype;
 	map<string, PoolingType> _string_map_pooltype;
+	map<string, OptimizerType> _string_map_optimizertype;
+	map<string, PipelineSchedule> _string_map_pipelineschedule;
+	map<string, ConvAlgo> _string_map_convalgo;
 
 public:
 
@@ -95,6 +122,9 @@ public:
     void setMinibatchSize(const int minibatch_size){
         _minibatch_size = minibatch_size;
     }
+    void setNumWorker(const int num_worker){
+        _num_worker = num_worker;
+    }
     void setNumTrainBatch(){
         _num_train_batch = _num_train / _minibatch_size;
     }
@@ -162,6 +192,15 @@ public:
     int getMinibatchSize(){
         return _minibatch_size;
     }
+    int getNumWorker(){
+        return _num_worker;
+    }
+    bool isPipeline(){
+        return _num_stage > 1;
+    }
+    int getWorkerMinibatchSize(){
+        return _is_hogwild ? _minibatch_size : _minibatch_size / _num_worker;
+    }
     int getNumTrainBatch(){
         return _num_train_batch;
     }
@@ -0,0 +1,80 @@
+///
+/// \file net_graph.hpp
+/// \brief 网络的静态图：层是节点，层的输出是有名字的tensor
+///
+
+#ifndef NET_GRAPH_H_
+#define NET_GRAPH_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include "param.h"
+
+using namespace std;
+
+#define DATA_TENSOR "data"   ///>输入图片的tensor名
+
+/// \brief 由json中每层的top和bottom建立，排出执行顺序并推断每个tensor的形状
+///
+/// 不写top时输出名就是层名，不写bottom时输入是json中上一层的输出，
+/// 第一层的输入是数据，所以原来的线性网络不需要修改。
+/// 节点编号是层在json中的下标，执行顺序中的位置是层在_layers中的下标
+class NetGraph {
+
+public:
+	/// \brief 加入一层，返回节点编号
+	int addNode(const string& name, const string& top, const vector<string>& bottoms);
+
+	/// \brief 按依赖关系排出执行顺序，同时可以执行的层中先排json里靠前的。
+	/// 输入不存在、输出重名、有环或者最后一层之外的层输出没有被使用时报错退出
+	void schedule();
+
+	inline int getNumNode() {
+		return _nodes.size();
+	}
+	/// \brief 执行顺序中第pos个节点
+	inline int getNode(const int pos) {
+		return _order[pos];
+	}
+	inline int getNumBottom(const int node) {
+		return _nodes[node].bottoms.size();
+	}
+	/// \brief 第node个节点的第b个输入由哪个节点输出，-1表示数据
+	inline int getProducer(const int node, const int b) {
+		return _nodes[node].producers[b];
+	}
+	/// \brief 输入在_y中的下标，0是数据，j+1是执行顺序中第j层的输出
+	inline int getBottomIdx(const int node, const int b) {
+		const int producer = _nodes[node].producers[b];
+		return producer < 0 ? 0 : _pos[producer] + 1;
+	}
+
+	/// \brief node的输出和shape_param的输出形状相同，空表示和数据相同
+	inline void setShapeParam(const int node, Param* shape_param) {
+		_nodes[node].shape_param = shape_param;
+	}
+	/// \brief 第b个输入的形状由哪一层的参数给出，空表示数据
+	inline Param* getBottomShape(const int node, const int b) {
+		const int producer = _nodes[node].producers[b];
+		return producer < 0 ? NULL : _nodes[producer].shape_param;
+	}
+
+private:
+	struct Node {
+		string name;
+		string top;
+		vector<string> bottoms;
+		vector<int> producers;
+		vector<int> consumers;
+		Param* shape_param;
+	};
+
+	vector<Node> _nodes;
+	vector<int> _order;
+	vector<int> _pos;   ///>每个节点在执行顺序中的位置
+};
+
+#include "../src/net_graph.cpp"
+
+#endif
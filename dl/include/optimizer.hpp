@@ -0,0 +1,193 @@
+///
+/// \file optimizer.hpp
+/// \brief 参数更新规则，每种规则对连续存放的参数用一次kernel更新
+///
+
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include <iostream>
+#include <algorithm>
+#include <cuda_runtime.h>
+#include "param.h"
+#include "matrix_kernel.hpp"
+#include "optimizer_kernel.cuh"
+
+using namespace std;
+
+/// \brief 更新规则的接口，超参数在json的optimizer里设置，
+/// 学习率、动量和weight decay仍然是每层自己的
+///
+/// 除了参数和导数以外，每种规则需要getNumState()段和参数一样长的状态，由optimizer
+/// 保存，布局和参数相同。kernel一次把参数、导数和所有状态读写完，状态可以用bf16
+/// 存放，读进来以后都用float计算
+class Optimizer {
+
+public:
+	Optimizer();
+	virtual ~Optimizer();
+
+	virtual int getNumState() {
+		return 1;
+	}
+
+	/// \brief 在createState之前调用，状态改为bf16存放，显存和带宽减半
+	inline void setBF16State(const bool is_bf16_state) {
+		_is_bf16_state = is_bf16_state;
+	}
+
+	/// \brief 分配getNumState()段长度为len的状态并置0，已有的状态被释放
+	void createState(const int len);
+
+	/// \brief 更新segments中的num_seg段，max_len是其中最长的一段
+	virtual void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len) = 0;
+
+	virtual void printParam() = 0;
+
+protected:
+	inline dim3 getBlocks(const int num_seg, const int max_len) {
+		return dim3(min(DIVUP(max_len / 4, UPDATE_BLOCK_SIZE), MAX_NUM_KERNEL), \
+				num_seg);
+	}
+
+	template <typename State>
+	inline State* getState(const int k) {
+		return static_cast<State*>(_d_states[k]);
+	}
+
+	/// \brief 返回置0的2*num_seg个float，给需要每段范数的规则使用
+	float* resetNorms(const int num_seg);
+
+	void printStateType();
+
+	bool _is_bf16_state;
+	unsigned long long _seed;   ///>bf16随机舍入的种子，所有进程相同，保证参数一致
+
+private:
+	void* _d_states[2];
+	float* _d_norms;
+	int _norms_capacity;
+};
+
+/// \brief 带动量的sgd，也是没有设置optimizer时的默认规则
+class SgdOptimizer : public Optimizer {
+
+public:
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks);
+};
+
+class NesterovOptimizer : public Optimizer {
+
+public:
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks);
+};
+
+/// \brief 第0段状态是一阶矩，第1段是二阶矩
+class AdamOptimizer : public Optimizer {
+
+public:
+	AdamOptimizer(const float beta1, const float beta2, const float eps, \
+			const bool is_decoupled = false) \
+		: _beta1(beta1), _beta2(beta2), _eps(eps), _is_decoupled(is_decoupled) {}
+
+	int getNumState() {
+		return 2;
+	}
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+protected:
+	float _beta1;
+	float _beta2;
+	float _eps;
+	bool _is_decoupled;   ///>weight decay不经过二阶矩的缩放
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks);
+};
+
+class AdamWOptimizer : public AdamOptimizer {
+
+public:
+	AdamWOptimizer(const float beta1, const float beta2, const float eps) \
+		: AdamOptimizer(beta1, beta2, eps, true) {}
+};
+
+/// \brief 状态是导数平方的滑动平均，不使用每层的momentum
+class RMSPropOptimizer : public Optimizer {
+
+public:
+	RMSPropOptimizer(const float rho, const float eps) \
+		: _rho(rho), _eps(eps) {}
+
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks);
+
+	float _rho;
+	float _eps;
+};
+
+/// \brief 层级自适应的带动量sgd，每段w的学习率乘以trust ratio
+/// eta*|w|/(|g|+decay*|w|)，大minibatch时各层步长和权重大小成比例
+class LarsOptimizer : public Optimizer {
+
+public:
+	LarsOptimizer(const float eta) : _eta(eta) {}
+
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks, float* norms);
+
+	float _eta;
+};
+
+/// \brief adamw的更新方向r按每段|w|/|r|缩放，需要先算完整段的r才知道范数，
+/// 所以分两遍：第一遍更新矩并求范数，第二遍更新参数
+class LambOptimizer : public AdamOptimizer {
+
+public:
+	LambOptimizer(const float beta1, const float beta2, const float eps) \
+		: AdamOptimizer(beta1, beta2, eps, true) {}
+
+	void update(float* pars, const float* derivs, \
+			const ParsSegment* segments, const int num_seg, const int max_len);
+	void printParam();
+
+private:
+	template <typename State>
+	void launch(float* pars, const float* derivs, \
+			const ParsSegment* segments, const dim3 blocks, float* norms);
+};
+
+#include "../src/optimizer.cu"
+
+#endif
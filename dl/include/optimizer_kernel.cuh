@@ -0,0 +1,87 @@
+/*
+ * filename: optimizer_kernel.cuh
+ */
+#ifndef OPTIMIZER_KERNEL_CUH_
+#define OPTIMIZER_KERNEL_CUH_
+
+//参数在连续空间中每一段的起点和长度都按这个个数对齐，kernel里按float4读写
+#define PARS_ALIGN 32
+#define UPDATE_BLOCK_SIZE 256
+
+/// \brief 连续存放的参数中的一段，一层的w或者bias，每段有自己的超参数
+struct ParsSegment {
+	int start;   ///>在连续空间中的起点
+	int len;     ///>补齐到PARS_ALIGN的长度，补齐部分的参数和导数始终为0
+	float lr;
+	float grad_scale;   ///>导数乘以它得到平均导数，即1/minibatch
+	float momentum;
+	float weight_decay;   ///>已经乘过初始的lr，sgd和nesterov使用
+	float decay_coef;   ///>没有乘lr的weight decay系数，lr改变时不变，其他optimizer使用
+	int step;   ///>这一段已经更新的次数，包括本次，adam做偏差修正用
+	int is_bias;   ///>bias段不做lars/lamb的层级缩放
+};
+
+/// \brief bfloat16，float的高16位，只用来保存optimizer的状态，计算时转成float
+struct bf16 {
+	unsigned short x;
+};
+
+//下面的kernel的grid都是(x, 段数)，每个y处理一段，一次读写参数、导数和状态。
+//State是状态的存储类型，float或bf16，bf16写回时用seed和step生成的随机数做
+//随机舍入，期望等于float的值，小的更新不会因为舍入被一直丢掉
+
+/// \brief inc = m*inc - decay*w - lr*g, w += inc
+template <typename State>
+__global__ void sgd_momentum_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, \
+		const unsigned long long seed);
+
+/// \brief 先沿旧的动量走一步再算导数，等价于 w += -m*inc_old + (1+m)*inc
+template <typename State>
+__global__ void nesterov_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, \
+		const unsigned long long seed);
+
+/// \brief is_decoupled为true时是adamw，weight decay直接作用在参数上，
+/// 否则作为L2项加到导数上
+template <typename State>
+__global__ void adam_update(float* pars, State* pars_m, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, const bool is_decoupled, \
+		const unsigned long long seed);
+
+/// \brief v = rho*v + (1-rho)*g^2, w -= lr*g/(sqrt(v)+eps)
+template <typename State>
+__global__ void rmsprop_update(float* pars, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float rho, \
+		const float eps, const unsigned long long seed);
+
+/// \brief 每段x和y的平方和分别加到norms[2*段号]和norms[2*段号+1]，norms需要先置0
+__global__ void segment_sq_norms(const float* x, const float* y, \
+		const ParsSegment* segments, float* norms);
+
+/// \brief 带动量的sgd，每段的学习率乘以eta*|w|/(|g|+decay*|w|)，
+/// norms是segment_sq_norms(pars, derivs)的结果
+template <typename State>
+__global__ void lars_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, const float* norms, \
+		const float eta, const unsigned long long seed);
+
+/// \brief lamb的第一遍，更新一阶和二阶矩，同时把|w|^2和adamw方向的|r|^2加到norms
+template <typename State>
+__global__ void lamb_moments(const float* pars, State* pars_m, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, float* norms, \
+		const unsigned long long seed);
+
+/// \brief lamb的第二遍，由矩重新算出r，w -= lr*|w|/|r|*r
+template <typename State>
+__global__ void lamb_update(float* pars, const State* pars_m, \
+		const State* pars_v, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, const float* norms);
+
+/// \brief y = a*y + b*x，len是4的倍数
+__global__ void axpby(float* y, const float* x, const float a, const float b, \
+		const int len);
+
+#endif
@@ -5,14 +5,18 @@
 #define PARAM_H_
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <cmath>
 
 using namespace std;
 
-#define MAX_THREAD_SIZE 32
+#define MAX_THREAD_SIZE 32   ///>box输出的默认边长，实际大小由层根据共享内存决定
+#define MIN_THREAD_SIZE 4   ///>autotune时box输出的最小边长
 #define MAX_NUM_KERNEL 4096
 #define MAX_NUM_THREAD 1024
+#define MIN_NUM_THREAD 128   ///>autotune时每个block最少的线程数，依次翻倍到MAX_NUM_THREAD
+#define AUTOTUNE_REPEAT 10   ///>autotune时每种配置计时的执行次数
 
 typedef enum PARAM_CONNECT_TYPE {
     PARAM_CONNECT_TYPE_LOCAL = 0,
@@ -24,6 +28,27 @@ typedef enum POOLING_TYPE {
 	AVG_POOLING = 1
 } PoolingType;
 
+typedef enum OPTIMIZER_TYPE {
+	SGD = 0,
+	NESTEROV = 1,
+	ADAM = 2,
+	ADAMW = 3,
+	RMSPROP = 4,
+	LARS = 5,
+	LAMB = 6
+} OptimizerType;
+
+typedef enum PIPELINE_SCHEDULE {
+	GPIPE = 0,
+	ONE_F_ONE_B = 1
+} PipelineSchedule;
+
+typedef enum CONV_ALGO {
+	CONV_AUTO = 0,   ///>第一次创建层时计时选择，结果保存在缓存文件里
+	CONV_DIRECT = 1,
+	CONV_IM2COL = 2
+} ConvAlgo;
+
 typedef enum PARAM_TRAIN_TYPE {
     NOTNEED = 0,
     NEED = 1
@@ -39,7 +64,9 @@ typedef enum LAYER_TYPE {
     DROPOUT = 6,
 	PREDICTOBJECT = 7,
 	RECOMMENDSUBSTITUE = 8,
-	RECOMMENDCOMPATIBLE = 9
+	RECOMMENDCOMPATIBLE = 9,
+	ELTWISE_SUM = 10,
+	CONCAT = 11
 } LayerType;
 
 /// \brief 实现了每一层的参数
@@ -47,13 +74,14 @@ typedef enum LAYER_TYPE {
 class Param {
 
 public:
-    Param() { }
+    Param() : _is_tuned(false), _forward_config(0), _backward_config(0) { }
 
     virtual ~Param() { }
 
     Param(string name, LayerType layer_type) : \
                 _name(name), _layer_type(layer_type), \
-				_param_train_type(NOTNEED){}
+				_param_train_type(NOTNEED), _is_tuned(false), \
+				_forward_config(0), _backward_config(0){}
 
 	virtual int getNumOut() {return 0;}
 	virtual int getOutChannel() {return 0;}
@@ -75,6 +103,11 @@ public:
     LayerType getLayerType(){
         return _layer_type;
     }
+	/// \brief 一张图片输出的长度
+	inline int getOutLen() {
+		return type == PARAM_CONNECT_TYPE_LOCAL \
+			? getOutHeight() * getOutWidth() * getOutChannel() : getNumOut();
+	}
     virtual void printParam(){
         cout << "\n============"<< _name << "============" \
                 << "\nlayer_type: " << _layer_type;
@@ -83,12 +116,32 @@ public:
 		_minibatch_size = minibatch_size;
 	}
 
+	/// \brief autotune选出的前向和反向配置的编号，含义由层决定，
+	/// 保存在参数里使数据并行的副本创建层时直接使用
+	inline void setTunedConfig(const int forward_config, const int backward_config){
+		_forward_config = forward_config;
+		_backward_config = backward_config;
+		_is_tuned = true;
+	}
+	inline bool isTuned(){
+		return _is_tuned;
+	}
+	inline int getForwardConfig(){
+		return _forward_config;
+	}
+	inline int getBackwardConfig(){
+		return _backward_config;
+	}
+
 protected:
     string _name;  ///> 实例化每一层的名字，用来区分不同的层
     static int _minibatch_size;
     ConnectType type;
     ParamTrainType _param_train_type;
     LayerType _layer_type;
+    bool _is_tuned;
+    int _forward_config;
+    int _backward_config;
 };
 
 /// \brief 实现了需要训练的层参数，主要为了改变权重和调节学习率
@@ -102,7 +155,8 @@ public:
             const float momentum, const float weight_decay, \
 			const float w_gauss) \
 		: _w_lr(w_lr), _b_lr(b_lr), _momentum(momentum), \
-		_weight_decay(w_lr*weight_decay), _w_gauss(w_gauss){	
+		_weight_decay(w_lr*weight_decay), _decay_coef(weight_decay), \
+		_w_gauss(w_gauss){	
 		this->_param_train_type = NEED;
 	}
 
@@ -127,6 +181,10 @@ public:
 	inline float getWeightDecay() {
 		return _weight_decay;
 	}
+	/// \brief 没有乘lr的系数，学习率改变后也不变
+	inline float getDecayCoef() {
+		return _decay_coef;
+	}
 	float getWGauss() {
 		return _w_gauss;
 	}
@@ -143,6 +201,7 @@ protected:
     float _b_lr;
     float _momentum;
 	float _weight_decay;
+	float _decay_coef;
 	float _w_gauss;
 
 };
@@ -173,40 +232,7 @@ public:
 			_padded_in_width = in_width + 2 * pad_width;
 			_out_height = ceil(((_padded_in_height - filter_height)*1.0f) / stride_height) + 1;
 			_out_width = ceil(((_padded_in_width - filter_width)*1.0f) / stride_width) + 1;
-			_box_num_height = ceil((this->getOutHeight() - MAX_THREAD_SIZE) \
-							* 1.0f / MAX_THREAD_SIZE) + 1;
-			_box_num_width = ceil((this->getOutWidth() - MAX_THREAD_SIZE) \
-							* 1.0f / MAX_THREAD_SIZE) + 1;
-			_box_out_height = MAX_THREAD_SIZE > _out_height \
-					? _out_height : MAX_THREAD_SIZE;
-			_box_out_width = MAX_THREAD_SIZE > _out_width \
-					? _out_width : MAX_THREAD_SIZE;
-			_box_in_height = (_box_out_height - 1) * stride_height + filter_height;
-			_box_in_width = (_box_out_width - 1) * stride_width + filter_width;
-			
-			int pow2Length = _out_height; 
-			if(pow2Length & (pow2Length - 1)){
-				while(pow2Length & (pow2Length - 1)){
-					pow2Length &= pow2Length - 1;
-				}
-				pow2Length *= 2;
-			}
-			_thread_height = pow2Length > MAX_THREAD_SIZE \
-							 ? MAX_THREAD_SIZE : pow2Length;
-
-			pow2Length = _out_width; 
-			if(pow2Length & (pow2Length - 1)){
-				while(pow2Length & (pow2Length - 1)){
-					pow2Length &= pow2Length - 1;
-				}
-				pow2Length *= 2;
-			}
-			_thread_width = pow2Length > MAX_THREAD_SIZE \
-							? MAX_THREAD_SIZE : pow2Length;
-
-			_overlap_height = _filter_height - stride_height;
-			_overlap_width = _filter_width - stride_width;
-
+			setBoxOutSize(MAX_THREAD_SIZE, MAX_THREAD_SIZE);
 		}
 
     LocalConnectParam(LayerType layer_type, string name, \
@@ -217,7 +243,7 @@ public:
 		: _in_height(lc_par->getOutHeight()), _in_width(lc_par->getOutWidth()), \
 		_stride_height(stride_height), _stride_width(stride_width), \
 		_in_channel(lc_par->getOutChannel()), _pad_height(pad_height), \
-		_filter_height(filter_height), _filter_width(filter_width) {
+		_pad_width(pad_width), _filter_height(filter_height), _filter_width(filter_width) {
 
             this->_layer_type = layer_type;
 			this->_name = name;
@@ -229,48 +255,26 @@ public:
 			this->type = PARAM_CONNECT_TYPE_LOCAL;
 
 			_padded_in_height = _in_height + 2 * pad_height;
-			_padded_in_width = _in_width + 2 * pad_height;
+			_padded_in_width = _in_width + 2 * pad_width;
 			_out_height = ceil(((_padded_in_height - filter_height)*1.0f) / stride_height) + 1;
 			_out_width = ceil(((_padded_in_width - filter_width)*1.0f) / stride_width) + 1;
-			_box_num_height = ceil((this->getOutHeight() - MAX_THREAD_SIZE) \
-							* 1.0f / MAX_THREAD_SIZE) + 1;
-			_box_num_width = ceil((this->getOutWidth() - MAX_THREAD_SIZE) \
-							* 1.0f / MAX_THREAD_SIZE) + 1;
-	
-			_box_out_height = MAX_THREAD_SIZE > _out_height \
-					? _out_height : MAX_THREAD_SIZE;
-			_box_out_width = MAX_THREAD_SIZE > _out_width \
-					? _out_width : MAX_THREAD_SIZE;
-
-			_box_in_height = (_box_out_height - 1) * stride_height + filter_height;
-			_box_in_width = (_box_out_width - 1) * stride_width + filter_width;
-			
-			int pow2Length = _out_height; 
-			if(pow2Length & (pow2Length - 1)){
-				while(pow2Length & (pow2Length - 1)){
-					pow2Length &= pow2Length - 1;
-				}
-				pow2Length *= 2;
-			}
-			_thread_height = pow2Length > MAX_THREAD_SIZE \
-							 ? MAX_THREAD_SIZE : pow2Length;
-
-			pow2Length = _out_width; 
-			if(pow2Length & (pow2Length - 1)){
-				while(pow2Length & (pow2Length - 1)){
-					pow2Length &= pow2Length - 1;
-				}
-				pow2Length *= 2;
-			}
-			_thread_width = pow2Length > MAX_THREAD_SIZE \
-							? MAX_THREAD_SIZE : pow2Length;
-			
-			_overlap_height = _filter_height - stride_height;
-			_overlap_width = _filter_width - stride_width;
-
-
+			setBoxOutSize(MAX_THREAD_SIZE, MAX_THREAD_SIZE);
 		}
 
+	/// \brief 设置一个box(一个block)计算的输出大小，其余box参数随之改变
+	///
+	/// 超过输出大小时取输出大小，box个数向上取整，最后一个box可能不满
+	void setBoxOutSize(const int box_out_height, const int box_out_width){
+		_box_out_height = box_out_height > _out_height \
+				? _out_height : box_out_height;
+		_box_out_width = box_out_width > _out_width \
+				? _out_width : box_out_width;
+		_box_num_height = (_out_height + _box_out_height - 1) / _box_out_height;
+		_box_num_width = (_out_width + _box_out_width - 1) / _box_out_width;
+		_box_in_height = (_box_out_height - 1) * _stride_height + _filter_height;
+		_box_in_width = (_box_out_width - 1) * _stride_width + _filter_width;
+	}
+
     inline int getInHeight() {
         return _in_height;
     }
@@ -314,18 +318,6 @@ public:
     inline int getPadWidth(){
         return _pad_width;
     }
-	int getOverlapHeight(){
-		return _overlap_height;
-	}
-	int getOverlapWidth(){
-		return _overlap_width;
-	}
-	int getThreadHeight(){
-		return _thread_height;
-	}
-	int getThreadWidth(){
-		return _thread_width;
-	}
     void printParam(){
         Param::printParam();
         cout << "\nin_height: " << _in_height \
@@ -379,10 +371,6 @@ private:
 	int _box_out_width; 
 	int _box_num_height;  ///>总的box个数的行 
 	int _box_num_width;  ///>总的box个数的列 
-	int _thread_height;
-	int _thread_width;
-	int _overlap_height;
-	int _overlap_width;
 };
 
 /// \brief 全连接层的参数，展开图片为一个矢量保存数据
@@ -440,7 +428,7 @@ private:
 
 class ConvParam : public TrainParam, public LocalConnectParam {
 public:
-    ConvParam(){}
+    ConvParam() : _conv_algo(CONV_AUTO) {}
 
     ~ConvParam(){}
 
@@ -458,7 +446,7 @@ public:
               LocalConnectParam(layer_type, name, in_height, in_width, \
 		            pad_height, pad_width, stride_height, stride_width, \
 					in_channel, filter_height, \
-					filter_width, filter_channel) {}
+					filter_width, filter_channel), _conv_algo(CONV_AUTO) {}
 
     ConvParam(const LayerType layer_type, const string name, const float w_lr, \
             const float b_lr, const float momentum, \
@@ -470,11 +458,23 @@ public:
             : TrainParam(w_lr, b_lr, momentum, weight_decay, w_gauss), \
               LocalConnectParam(layer_type, name, pad_height, pad_width, stride_height, \
 					  stride_width, \
-		            filter_height, filter_width, filter_channel, lc_par)  {}
+		            filter_height, filter_width, filter_channel, lc_par), \
+              _conv_algo(CONV_AUTO) {}
     void printParam(){
         LocalConnectParam::printParam();
         TrainParam::printParam();
     }
+
+    /// \brief 数据并行的副本共享参数，CONV_AUTO的层只在主模型创建时选择一次
+    inline void setConvAlgo(const ConvAlgo conv_algo){
+        _conv_algo = conv_algo;
+    }
+    inline ConvAlgo getConvAlgo(){
+        return _conv_algo;
+    }
+
+private:
+    ConvAlgo _conv_algo;
 };
 
 class PoolParam : public LocalConnectParam {
@@ -520,10 +520,43 @@ private:
 };
 
 
+/// \brief 按channel拼接几个输入，输入的高和宽必须相同，全连接的输入看作高和宽为1
+class ConcatParam : public LocalConnectParam {
+public:
+    ConcatParam() {}
+    ~ConcatParam() {}
+
+    ConcatParam(const LayerType layer_type, const string name, \
+            const int in_height, const int in_width, const vector<int>& in_channels) \
+            : LocalConnectParam(layer_type, name, in_height, in_width, 0, 0, 1, 1, \
+                    sumChannels(in_channels), 1, 1, sumChannels(in_channels)) {
+        for (int i = 0; i < in_channels.size(); ++i)
+            _in_lens.push_back(in_channels[i] * in_height * in_width);
+    }
+
+    /// \brief 第i个输入一张图片的长度
+    inline const vector<int>& getInLens() {
+        return _in_lens;
+    }
+    void printParam(){
+        LocalConnectParam::printParam();
+    }
+
+private:
+    static int sumChannels(const vector<int>& in_channels) {
+        int sum = 0;
+        for (int i = 0; i < in_channels.size(); ++i)
+            sum += in_channels[i];
+        return sum;
+    }
+
+    vector<int> _in_lens;
+};
+
 /// \brief 可以进行训练的全连接层
 class InnerParam : public TrainParam, public FullConnectParam {
 public:
-    InnerParam(){}
+    InnerParam() : _is_tensor_parallel(false), _shard_idx(0), _num_shard(1) {}
 
     ~InnerParam() {}
 
@@ -532,7 +565,8 @@ public:
 		const float weight_decay, const float w_gauss, \
 		const int num_in, const int num_out) \
         : TrainParam(w_lr, b_lr, momentum, weight_decay, w_gauss),
-          FullConnectParam(layer_type, name, num_in, num_out){}
+          FullConnectParam(layer_type, name, num_in, num_out), \
+		  _is_tensor_parallel(false), _shard_idx(0), _num_shard(1) {}
 
     InnerParam(const LayerType layer_type, const string name, \
         const float w_lr, const float b_lr, \
@@ -540,11 +574,43 @@ public:
 		const float w_gauss, \
         const int num_out, Param* par) \
         : TrainParam(w_lr, b_lr, momentum, weight_decay, w_gauss),  \
-          FullConnectParam(layer_type, name, num_out, par) {}
+          FullConnectParam(layer_type, name, num_out, par), \
+		  _is_tensor_parallel(false), _shard_idx(0), _num_shard(1) {}
+
+    inline void setTensorParallel(const bool is_tensor_parallel) {
+        _is_tensor_parallel = is_tensor_parallel;
+    }
+    inline bool isTensorParallel() {
+        return _is_tensor_parallel;
+    }
+    /// \brief 按列把w平均切成num_shard份，本进程只保存第shard_idx份
+    inline void setShard(const int shard_idx, const int num_shard) {
+        _shard_idx = shard_idx;
+        _num_shard = num_shard;
+    }
+    inline int getShardIdx() {
+        return _shard_idx;
+    }
+    inline int getNumShard() {
+        return _num_shard;
+    }
+    /// \brief 第idx份的第一列，idx等于份数时返回总列数
+    inline int getShardStart(const int idx) {
+        return (long long)idx * getNumOut() / _num_shard;
+    }
+    inline int getShardNumOut() {
+        return getShardStart(_shard_idx + 1) - getShardStart(_shard_idx);
+    }
     void printParam(){
         FullConnectParam::printParam();
         TrainParam::printParam();
+        cout << "\ntensor_parallel: " << _is_tensor_parallel;
     }
+
+private:
+    bool _is_tensor_parallel;
+    int _shard_idx;
+    int _num_shard;
 };
 
 #endif
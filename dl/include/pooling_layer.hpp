@@ -24,11 +24,25 @@ public:
 
     void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
 
+    ///> 前向和反向的配置都是每个block的线程数
+    int getNumForwardConfig() {
+        return this->getNumThreadConfig();
+    }
+    void setForwardConfig(const int idx) {
+        _forward_thread = this->getConfigThread(idx);
+    }
+    int getNumBackwardConfig() {
+        return this->getNumThreadConfig();
+    }
+    void setBackwardConfig(const int idx) {
+        _backward_thread = this->getConfigThread(idx);
+    }
+
 private:
-    Matrix<int>* _max_pos;
+    Matrix<unsigned char>* _max_pos;  ///>最大值在pooling窗口内的偏移
     PoolParam* _lcp;
-	Matrix<Dtype>* unranged_dE_dx;
-	int _num_box;
+    int _forward_thread;
+    int _backward_thread;
 };
 
 #include "../src/pooling_layer.cu"
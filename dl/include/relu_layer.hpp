@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include "layer.hpp"
+#include "layer_kernel.cuh"
 
 template <typename Dtype>
 class ReluLayer : public Layer<Dtype> {
@@ -20,9 +21,16 @@ public:
 	void computeOutput(Matrix<Dtype>* x);
 	void computeDerivsOfInput(Matrix<Dtype>* dE_dx);
 
+	/// \brief 在initCuda之前调用，producer是已经合并了relu的卷积层，
+	/// 本层和它共用_y和_dE_dy，前向不做任何计算，反向原地把导数乘上mask
+	inline void fuseInto(Layer<Dtype>* producer) {
+		_producer = producer;
+	}
+
 private:
 	Param* _p;
 	Matrix<int> *_record;
+	Layer<Dtype>* _producer;   ///>合并到的层，为空时是单独的一层
 };
 
 
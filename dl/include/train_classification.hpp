@@ -7,6 +7,7 @@
 #ifndef TRAINCLASSIFICATION_H_
 #define TRAINCLASSIFICATION_H_
 
+#include <pthread.h>
 #include "train_model.hpp"
 
 /// \brief
@@ -14,14 +15,47 @@
 template<typename Dtype>
 class TrainClassification : public TrainModel<Dtype> {
 private:
+	TrainClassification<Dtype>* _master;  ///>0号worker，保存共享的主机缓存和barrier
+	Dtype* _h_mini_pixel;   ///>整个minibatch的主机缓存，每个worker拷贝自己的一段
+	int* _h_mini_label;
+	pthread_barrier_t _barrier;
+
+	//流水线并行，第s段是第_stage_begin[s]到_stage_begin[s+1]-1层，
+	//第m个worker保存第m个micro-batch的输出和导数
+	vector<int> _stage_begin;
+	vector<int> _forward_done;   ///>每段已经做完前向的micro-batch个数
+	vector<int> _backward_done;
+	pthread_mutex_t _stage_mutex;
+	pthread_cond_t _stage_cond;
+	vector< pair<TrainClassification<Dtype>*, int> > _stage_args;
+
+	static void* runWorker(void* model);
+	void trainWorker();
+	void loadOneBatch(bool is_train, int batch_idx);
+	void mergeWorkerResult();
+	void printTrainResult(const int epoch_idx, const int num_train_batch);
+	void printValidResult();
+	void resetWorkerResult();
+
+	void createStages();
+	static void* runStage(void* arg);
+	void trainStage(const int stage);
+	void runPipeline(const int stage, bool is_train, int batch_idx);
+	void forwardMicroBatch(const int stage, const int m);
+	void backwardMicroBatch(const int stage, const int m);
+	void waitStage(vector<int>& done, const int stage, const int m);
+	void signalStage(vector<int>& done, const int stage);
 
 public:
     TrainClassification(bool has_valid, bool is_test) \
-		: TrainModel<Dtype>(has_valid, is_test) {}
-    ~TrainClassification() {}
+		: TrainModel<Dtype>(has_valid, is_test) {
+		_master = this;
+	}
+    ~TrainClassification();
 
     void createPixelAndLabel();
 	void parseImgBinary(string train_file, string valid_file);
+	void createWorkers();
 
 	void forwardLastLayer();
 	void backwardLastLayer();
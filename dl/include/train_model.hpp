@@ -7,8 +7,16 @@
 #ifndef TRAINMODEL_H_
 #define TRAINMODEL_H_
 
+#include <deque>
+#include <pthread.h>
 #include "model_component.hpp"
 #include "load_layer.hpp"
+#include "communicator.hpp"
+#include "optimizer.hpp"
+#include "engine.hpp"
+#include "net_graph.hpp"
+
+#define BUCKET_SIZE 262144   ///>一个bucket至少攒够这么多个导数才开始通信
 
 using namespace std;
 
@@ -32,21 +40,76 @@ protected:
 	bool _is_test;
 	int _num_data_type;  //train是0，valid是1，test是2
 
+	//数据并行，每个worker是一个模型副本，0号是主模型，副本共享主模型的权重
+	vector< TrainModel<Dtype>* > _workers;
+	int _worker_idx;
+
+	//多进程数据并行，每个进程只处理一部分minibatch，导数通过_comm求平均
+	Communicator* _comm;
+	Dtype* _h_pars;   ///>所有权重和bias首尾相连的主机缓存，用来进程间传递
+	int _num_pushed_layers;   ///>这一步已经放进_h_pars的层数，按导数算完的顺序
+	int _pushed_len;
+	int _bucket_start;   ///>还没有提交通信的bucket在_h_pars中的起点
+	//optimizer状态分片，每个进程只保存和更新连续的几段参数，更新完allgather参数
+	bool _is_shard;
+	vector<int> _shard_segs;   ///>第r个进程更新第_shard_segs[r]到_shard_segs[r+1]-1段
+	vector<int> _shard_starts;   ///>对应在连续空间中的起点，最后一个是_pars_len
+	//local sgd，进程之间不传导数，各自更新_local_step次以后对参数求平均
+	int _local_step;
+	int _num_local_update;
+
+	//反向传播时由另一个线程计算参数导数(并更新)，和下面层的输入导数计算重叠
+	vector<int> _train_layer_idx;   ///>第j个需要训练的层在_layers中的下标
+	pthread_t _pars_thread;
+	bool _is_pars_thread_started;
+	bool _is_pars_stop;
+	pthread_mutex_t _pars_mutex;
+	pthread_cond_t _pars_cond;
+	deque<int> _pars_queue;   ///>dE_dy已经算好、等待计算参数导数的层
+	int _num_pars_done;
+	int _input_done_idx;   ///>输入导数已经算到的层，更新权重要等本层用旧权重算完
+
+	vector<ParsSegment> _segments;   ///>每层的w和bias各是一段，超参数每次更新前填写
+	ParsSegment* _d_segments;
+	Optimizer* _optimizer;   ///>主模型创建，hogwild时副本也用它更新共享的参数
+	int _warmup_epoch;   ///>学习率线性增加的epoch数，大minibatch时避免开始发散
+	//hogwild，每个副本不加锁地更新共享参数，延迟超过限制的层跳过这次更新
+	vector<int> _read_version;   ///>本次前向时每个需要训练层的参数版本
+	int _num_stale_skip;   ///>因为延迟太大被跳过的层更新次数
+	int _tensor_rank;   ///>切分的层在本进程保存第几份
+
 public:
     TrainModel(bool has_valid, bool is_test);
     virtual ~TrainModel();
 
     void parseNetJson(string json_file);
 
+    void setTensorParallel(const int rank, const int num_process);
     void createLayer();
     void createYDEDY();
-    void createWBias();
+    void createWBias(TrainModel<Dtype>* master = NULL);
 
     void initWeightByRandom();
     void initWeightByFile(vector<string> w_file, vector<string> bias_file);
     void forwardPropagate();
     void backwardPropagate();
-    void computeAndUpdatePars();
+    void forwardLayer(const int k);
+    void backwardLayer(const int k);
+    void forwardLayers(const int begin, const int end);
+    void backwardLayers(const int begin, const int end);
+    void reduceDerivsOfPars();
+    void pushDerivsOfPars(const int k);
+    void allReduceDerivsOfPars();
+    void updateLayerPars(const int k, const int num_layer);
+    void updatePars();
+    void reduceScatterDerivsOfPars();
+    void updateShardPars();
+    void allGatherPars();
+    void averagePars();
+    void warmupLR(const int epoch_idx);
+
+    void setCommunicator(Communicator* comm);
+    void broadcastPars();
 
 	virtual void forwardLastLayer() {}
 	virtual void backwardLastLayer() {}
@@ -56,6 +119,48 @@ public:
 	//返回是true就停下，返回是false就继续执行
 	void earlyStopping(int epoch_idx);
 
+private:
+	static void* runParsThread(void* model);
+	void computeParsLoop();
+
+	void getBottomDims(NetGraph& graph, const int i, const int b, \
+			int& channel, int& height, int& width);
+	Param* parseEltwiseParam(NetGraph& graph, const int i, const string& name);
+	Param* parseConcatParam(NetGraph& graph, const int i, const string& name);
+
+	/// \brief 第i层是relu，而且可以合并进产生它输入的卷积层
+	bool isFusibleRelu(const int i);
+
+	/// \brief 测第i层每个前向和反向配置的时间，把最快的记在层参数里
+	void autotuneLayer(const int i);
+
+	/// \brief 填写第k层开始的num_layer层的段，返回其中最长的一段
+	int fillSegments(const int k, const int num_layer);
+
+	/// \brief 只有一个副本或者hogwild，而且不需要进程间通信时，导数算完就可以更新，
+	/// 流水线时要等所有micro-batch的导数
+	inline bool isUpdateInBackward() {
+		return (_workers.size() <= 1 || _model_component->_is_hogwild) \
+			&& _comm == NULL && !_model_component->isPipeline();
+	}
+	/// \brief 第k个需要训练层从前向到现在被其他副本更新的次数没有超过限制
+	inline bool isFresh(const int k) {
+		ModelComponent<Dtype> *mc = _model_component;
+		return !mc->_is_hogwild || mc->_max_staleness[k] <= 0 \
+			|| mc->_pars_version[k] - _read_version[k] <= mc->_max_staleness[k];
+	}
+	inline bool isShardUpdate() {
+		return _is_shard && _comm != NULL && _comm->getNumProcess() > 1;
+	}
+	inline bool isLocalSGD() {
+		return _local_step > 1 && _comm != NULL && _comm->getNumProcess() > 1;
+	}
+	/// \brief 所有进程训练相同的数据，只有切分的层在层内通信，导数不需要求平均
+	inline bool isTensorParallel() {
+		return _model_component->_is_tensor_parallel && _comm != NULL \
+			&& _comm->getNumProcess() > 1;
+	}
+
 };
 
 #include "../src/train_model.cpp"
@@ -15,20 +15,51 @@ int Param::_minibatch_size = 0;
 
 int main(int argc, char** argv){
 
+#if MULTI_PROCESS
+	///> fork必须在初始化cuda之前，每个进程使用一块gpu
+#if MULTI_MECHINE
+	///> 单机上通过127.0.0.1测试，多机时换成每个进程所在机器的地址
+	Communicator *comm = new TcpCommunicator(NUM_PROCESS, \
+			vector<string>(NUM_PROCESS, "127.0.0.1"));
+#else
+	Communicator *comm = new ShmCommunicator(NUM_PROCESS);
+#endif
+	int rank = comm->forkProcesses();
+	comm->init();
+	int num_device;
+	cudaGetDeviceCount(&num_device);
+	cudaSetDevice(rank % num_device);
+#endif
+
 	TrainClassification<float> *cifar_model = new TrainClassification<float>(true, false);
 
 	cifar_model->parseNetJson("script/cifar10.json");
 	cout << "done1\n";
+#if MULTI_PROCESS
+	///> 标记了tensor_parallel的全连接层按列切分到各进程
+	cifar_model->setTensorParallel(rank, NUM_PROCESS);
+#endif
 	cifar_model->parseImgBinary("", "");
 	cifar_model->createLayer();
 	cifar_model->createWBias();
 	cifar_model->createPixelAndLabel();
 	cifar_model->createYDEDY();
 	cifar_model->initWeightByRandom();
+	cifar_model->createWorkers();
+#if MULTI_PROCESS
+	cifar_model->setCommunicator(comm);
+	cifar_model->broadcastPars();
+#endif
 	cifar_model->train();
 	 	
 	delete cifar_model;
 
+#if MULTI_PROCESS
+	if(rank == 0)
+		comm->waitProcesses();
+	delete comm;
+#endif
+
 
 	return 0;
 }
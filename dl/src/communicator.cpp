@@ -0,0 +1,492 @@
+///
+/// \file communicator.cpp
+/// @brief
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sstream>
+#include "communicator.hpp"
+#include "engine.hpp"
+
+using namespace std;
+
+//主机上的求和交给engine的线程池分段执行
+
+/// \brief y += x
+struct AddArg {
+	float* y;
+	const float* x;
+};
+
+static void addRange(void* arg, const int begin, const int end) {
+	AddArg* aa = static_cast<AddArg*>(arg);
+	for (int i = begin; i < end; ++i)
+		aa->y[i] += aa->x[i];
+}
+
+/// \brief 把num_slot个相隔stride的槽逐元素求和，写到result
+struct SumSlotsArg {
+	const float* slots;
+	int stride;
+	int num_slot;
+	float* result;
+};
+
+static void sumSlotsRange(void* arg, const int begin, const int end) {
+	SumSlotsArg* sa = static_cast<SumSlotsArg*>(arg);
+	for (int i = begin; i < end; ++i) {
+		float sum = 0;
+		for (int r = 0; r < sa->num_slot; ++r)
+			sum += sa->slots[r * sa->stride + i];
+		sa->result[i] = sum;
+	}
+}
+
+Communicator::Communicator() {
+	_rank = 0;
+	_num_process = 1;
+	_is_async_started = false;
+	_is_stop = false;
+	_num_pending = 0;
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+Communicator::~Communicator() {
+	if (_is_async_started) {
+		pthread_mutex_lock(&_mutex);
+		_is_stop = true;
+		pthread_cond_broadcast(&_cond);
+		pthread_mutex_unlock(&_mutex);
+		pthread_join(_async_thread, NULL);
+	}
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+int Communicator::forkProcesses() {
+	for (int i = 1; i < _num_process; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		} else if (pid == 0) {
+			_rank = i;
+			_children.clear();
+			return _rank;
+		}
+		_children.push_back(pid);
+	}
+	return _rank;
+}
+
+void Communicator::waitProcesses() {
+	for (int i = 0; i < _children.size(); ++i) {
+		int status;
+		waitpid(_children[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			cerr << "process " << i + 1 << " exited abnormally." << endl;
+	}
+	_children.clear();
+}
+
+void* Communicator::runAsync(void* comm) {
+	Communicator *c = static_cast<Communicator*>(comm);
+	pthread_mutex_lock(&c->_mutex);
+	while (true) {
+		while (c->_queue.empty() && !c->_is_stop)
+			pthread_cond_wait(&c->_cond, &c->_mutex);
+		if (c->_queue.empty())
+			break;
+		pair<float*, int> task = c->_queue.front();
+		c->_queue.pop_front();
+		pthread_mutex_unlock(&c->_mutex);
+
+		c->allReduce(task.first, task.second);
+
+		pthread_mutex_lock(&c->_mutex);
+		c->_num_pending--;
+		pthread_cond_broadcast(&c->_cond);
+	}
+	pthread_mutex_unlock(&c->_mutex);
+	return NULL;
+}
+
+void Communicator::allReduceAsync(float* data, const int len) {
+	pthread_mutex_lock(&_mutex);
+	if (!_is_async_started) {
+		pthread_create(&_async_thread, NULL, runAsync, this);
+		_is_async_started = true;
+	}
+	_queue.push_back(make_pair(data, len));
+	_num_pending++;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void Communicator::waitAll() {
+	pthread_mutex_lock(&_mutex);
+	while (_num_pending > 0)
+		pthread_cond_wait(&_cond, &_mutex);
+	pthread_mutex_unlock(&_mutex);
+}
+
+ShmCommunicator::ShmCommunicator(const int num_process) {
+	_num_process = num_process;
+	_rank = 0;
+	_slots = NULL;
+	_capacity = 0;
+	_launcher_pid = getpid();
+
+	_header = (ShmHeader*)mmap(NULL, sizeof(ShmHeader), PROT_READ | PROT_WRITE, \
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (_header == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&_header->barrier, &attr, num_process);
+	pthread_barrierattr_destroy(&attr);
+}
+
+ShmCommunicator::~ShmCommunicator() {
+	///> 等后台线程上的allreduce结束后再释放共享内存
+	waitAll();
+	if (_slots != NULL)
+		munmap(_slots, sizeof(float) * (_num_process + 1) * _capacity);
+	if (_rank == 0)
+		pthread_barrier_destroy(&_header->barrier);
+	munmap(_header, sizeof(ShmHeader));
+}
+
+void ShmCommunicator::barrier() {
+	pthread_barrier_wait(&_header->barrier);
+}
+
+void ShmCommunicator::reserve(const int len) {
+	if (len <= _capacity)
+		return;
+
+	if (_slots != NULL)
+		munmap(_slots, sizeof(float) * (_num_process + 1) * _capacity);
+
+	///> 每次扩容用新的名字，0号进程创建，其他进程打开以后再删除名字
+	static int generation = 0;
+	stringstream ss;
+	ss << "/dl_allreduce_" << _launcher_pid << "_" << generation++;
+	string name = ss.str();
+	size_t size = sizeof(float) * (_num_process + 1) * len;
+
+	int fd;
+	if (_rank == 0) {
+		fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0 || ftruncate(fd, size) != 0) {
+			perror("shm_open");
+			exit(EXIT_FAILURE);
+		}
+	}
+	barrier();
+	if (_rank != 0) {
+		fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd < 0) {
+			perror("shm_open");
+			exit(EXIT_FAILURE);
+		}
+	}
+	_slots = (float*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (_slots == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	barrier();
+	if (_rank == 0)
+		shm_unlink(name.c_str());
+
+	_capacity = len;
+}
+
+void ShmCommunicator::allReduce(float* data, const int len) {
+	reserve(len);
+
+	float* result = _slots + _num_process * _capacity;
+	memcpy(_slots + _rank * _capacity, data, sizeof(float) * len);
+	barrier();
+
+	///> reduce-scatter，每个进程负责一段
+	const int chunk = (len + _num_process - 1) / _num_process;
+	const int start = _rank * chunk;
+	const int end = start + chunk < len ? start + chunk : len;
+	SumSlotsArg arg = {_slots, _capacity, _num_process, result};
+	Engine::getInstance()->parallelFor(start, end, HOST_GRAIN_SIZE, \
+			sumSlotsRange, &arg);
+	barrier();
+
+	///> allgather，下一次调用只有在barrier之后才会改写result
+	memcpy(data, result, sizeof(float) * len);
+}
+
+void ShmCommunicator::reduceScatter(float* data, const vector<int>& starts) {
+	reserve(starts[_num_process]);
+
+	memcpy(_slots + _rank * _capacity, data, sizeof(float) * starts[_num_process]);
+	barrier();
+
+	SumSlotsArg arg = {_slots, _capacity, _num_process, data};
+	Engine::getInstance()->parallelFor(starts[_rank], starts[_rank + 1], \
+			HOST_GRAIN_SIZE, sumSlotsRange, &arg);
+	///> 所有进程读完以后槽才能被下一次调用改写
+	barrier();
+}
+
+void ShmCommunicator::allGather(float* data, const vector<int>& starts) {
+	reserve(starts[_num_process]);
+
+	///> 每个进程把自己那一段写到自己槽里的相同位置
+	memcpy(_slots + _rank * _capacity + starts[_rank], data + starts[_rank], \
+			sizeof(float) * (starts[_rank + 1] - starts[_rank]));
+	barrier();
+
+	for (int r = 0; r < _num_process; ++r) {
+		if (r == _rank)
+			continue;
+		memcpy(data + starts[r], _slots + r * _capacity + starts[r], \
+				sizeof(float) * (starts[r + 1] - starts[r]));
+	}
+	barrier();
+}
+
+void ShmCommunicator::broadcast(float* data, const int len) {
+	reserve(len);
+
+	///> 用0号槽传递，上一次allreduce的结果可能还有进程在读
+	if (_rank == 0)
+		memcpy(_slots, data, sizeof(float) * len);
+	barrier();
+	if (_rank != 0)
+		memcpy(data, _slots, sizeof(float) * len);
+	barrier();
+}
+
+TcpCommunicator::TcpCommunicator(const int num_process, \
+		const vector<string>& hosts, const int base_port) {
+	_num_process = num_process;
+	_rank = 0;
+	_hosts = hosts;
+	_base_port = base_port;
+	_next_fd = -1;
+	_prev_fd = -1;
+}
+
+TcpCommunicator::~TcpCommunicator() {
+	waitAll();
+	if (_next_fd >= 0)
+		close(_next_fd);
+	if (_prev_fd >= 0)
+		close(_prev_fd);
+}
+
+void TcpCommunicator::init() {
+	if (_num_process == 1)
+		return;
+
+	///> 先监听，再连下一个进程，最后接受上一个进程的连接
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int opt = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(_base_port + _rank);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 \
+			|| listen(listen_fd, 1) != 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+
+	const int next = (_rank + 1) % _num_process;
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	stringstream port;
+	port << _base_port + next;
+	if (getaddrinfo(_hosts[next].c_str(), port.str().c_str(), &hints, &res) != 0) {
+		cerr << "can not resolve " << _hosts[next] << endl;
+		exit(EXIT_FAILURE);
+	}
+	///> 下一个进程可能还没开始监听，重试一段时间
+	for (int retry = 0; ; ++retry) {
+		_next_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(_next_fd, res->ai_addr, res->ai_addrlen) == 0)
+			break;
+		close(_next_fd);
+		if (retry == 600) {
+			perror("connect");
+			exit(EXIT_FAILURE);
+		}
+		usleep(100000);
+	}
+	freeaddrinfo(res);
+
+	_prev_fd = accept(listen_fd, NULL, NULL);
+	if (_prev_fd < 0) {
+		perror("accept");
+		exit(EXIT_FAILURE);
+	}
+	close(listen_fd);
+
+	setsockopt(_next_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+	setsockopt(_prev_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+	fcntl(_next_fd, F_SETFL, fcntl(_next_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(_prev_fd, F_SETFL, fcntl(_prev_fd, F_GETFL) | O_NONBLOCK);
+}
+
+void TcpCommunicator::sendRecv(const float* send_data, const int send_len, \
+		float* recv_data, const int recv_len) {
+	const char *send_ptr = (const char*)send_data;
+	char *recv_ptr = (char*)recv_data;
+	size_t send_left = sizeof(float) * send_len;
+	size_t recv_left = sizeof(float) * recv_len;
+
+	while (send_left > 0 || recv_left > 0) {
+		struct pollfd fds[2];
+		int num_fd = 0;
+		if (send_left > 0) {
+			fds[num_fd].fd = _next_fd;
+			fds[num_fd].events = POLLOUT;
+			num_fd++;
+		}
+		if (recv_left > 0) {
+			fds[num_fd].fd = _prev_fd;
+			fds[num_fd].events = POLLIN;
+			num_fd++;
+		}
+		if (poll(fds, num_fd, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < num_fd; ++i) {
+			if (fds[i].revents & (POLLERR | POLLNVAL)) {
+				cerr << "ring connection is broken." << endl;
+				exit(EXIT_FAILURE);
+			}
+			if (fds[i].fd == _next_fd && (fds[i].revents & POLLOUT)) {
+				ssize_t n = send(_next_fd, send_ptr, send_left, MSG_NOSIGNAL);
+				if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("send");
+					exit(EXIT_FAILURE);
+				}
+				if (n > 0) {
+					send_ptr += n;
+					send_left -= n;
+				}
+			} else if (fds[i].fd == _prev_fd \
+					&& (fds[i].revents & (POLLIN | POLLHUP))) {
+				ssize_t n = recv(_prev_fd, recv_ptr, recv_left, 0);
+				if (n == 0) {
+					cerr << "ring connection is closed." << endl;
+					exit(EXIT_FAILURE);
+				}
+				if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("recv");
+					exit(EXIT_FAILURE);
+				}
+				if (n > 0) {
+					recv_ptr += n;
+					recv_left -= n;
+				}
+			}
+		}
+	}
+}
+
+/// 数据平均分成num_process段，先reduce-scatter再allgather
+void TcpCommunicator::allReduce(float* data, const int len) {
+	if (_num_process == 1)
+		return;
+
+	const int chunk = (len + _num_process - 1) / _num_process;
+	vector<int> starts(_num_process + 1);
+	for (int r = 0; r <= _num_process; ++r)
+		starts[r] = min(r * chunk, len);
+
+	reduceScatter(data, starts);
+	allGather(data, starts);
+}
+
+/// 第step步把第rank-step-1段的部分和发给下一个进程，同时收到上一个进程的
+/// 第rank-step-2段加到自己的上面，num_process-1步以后第rank段是所有进程的和
+void TcpCommunicator::reduceScatter(float* data, const vector<int>& starts) {
+	if (_num_process == 1)
+		return;
+
+	const int n = _num_process;
+	int max_chunk = 1;
+	for (int r = 0; r < n; ++r)
+		max_chunk = max(max_chunk, starts[r + 1] - starts[r]);
+	if (_recv_buf.size() < max_chunk)
+		_recv_buf.resize(max_chunk);
+
+	for (int step = 0; step < n - 1; ++step) {
+		const int send_idx = ((_rank - step - 1) % n + n) % n;
+		const int recv_idx = ((_rank - step - 2) % n + n) % n;
+		const int recv_len = starts[recv_idx + 1] - starts[recv_idx];
+
+		sendRecv(data + starts[send_idx], starts[send_idx + 1] - starts[send_idx], \
+				&_recv_buf[0], recv_len);
+		AddArg arg = {data + starts[recv_idx], &_recv_buf[0]};
+		Engine::getInstance()->parallelFor(0, recv_len, HOST_GRAIN_SIZE, \
+				addRange, &arg);
+	}
+}
+
+/// 第step步把第rank-step段转发给下一个进程，同时收到第rank-step-1段
+void TcpCommunicator::allGather(float* data, const vector<int>& starts) {
+	if (_num_process == 1)
+		return;
+
+	const int n = _num_process;
+	for (int step = 0; step < n - 1; ++step) {
+		const int send_idx = ((_rank - step) % n + n) % n;
+		const int recv_idx = ((_rank - step - 1) % n + n) % n;
+
+		sendRecv(data + starts[send_idx], starts[send_idx + 1] - starts[send_idx], \
+				data + starts[recv_idx], starts[recv_idx + 1] - starts[recv_idx]);
+	}
+}
+
+void TcpCommunicator::broadcast(float* data, const int len) {
+	if (_num_process == 1)
+		return;
+
+	///> 沿着环传递，最后一个进程不再发送
+	if (_rank != 0)
+		sendRecv(NULL, 0, data, len);
+	if (_rank != _num_process - 1)
+		sendRecv(data, len, NULL, 0);
+}
+
+void TcpCommunicator::barrier() {
+	float token = 0;
+	allReduce(&token, 1);
+}
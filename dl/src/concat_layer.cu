@@ -0,0 +1,75 @@
+///
+/// \file concat_layer.cu
+/// @brief
+
+#include "concat_layer.hpp"
+
+using namespace std;
+
+template <typename Dtype>
+ConcatLayer<Dtype>::ConcatLayer(ConcatParam* cp){
+
+	this->_cp           = cp;
+	const vector<int>& in_lens = cp->getInLens();
+	int offset = 0;
+	for(int i = 0; i < in_lens.size(); i++){
+		_offsets.push_back(offset);
+		offset += in_lens[i];
+	}
+}
+
+template <typename Dtype>
+ConcatLayer<Dtype>::~ConcatLayer() {
+	delete  this->_y; 
+	delete  this->_dE_dy;
+}
+
+template <typename Dtype>
+void ConcatLayer<Dtype>::initCuda() {
+
+	this->_y             = new Matrix<Dtype>(_cp->getMinibatchSize(), \
+								_cp->getOutLen());
+	this->_dE_dy         = new Matrix<Dtype>(this->_y);
+}
+
+template <typename Dtype>
+void ConcatLayer<Dtype>::computeOutput(Matrix<Dtype>* x){ 
+	computeMultiOutput(vector<Matrix<Dtype>*>(1, x));
+}
+
+template <typename Dtype>
+void ConcatLayer<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
+	computeMultiDerivsOfInput(vector<Matrix<Dtype>*>(1, dE_dx));
+}
+
+/// 第i个输入的每一行拷贝到输出每一行的_offsets[i]处
+template <typename Dtype>
+void ConcatLayer<Dtype>::computeMultiOutput(const vector<Matrix<Dtype>*>& xs){ 
+	const int out_len = this->_y->getNumCols();
+	const vector<int>& in_lens = _cp->getInLens();
+	for(int i = 0; i < xs.size(); i++){
+		cudaMemcpy2D(this->_y->getDevData() + _offsets[i], sizeof(Dtype) * out_len, \
+				xs[i]->getDevData(), sizeof(Dtype) * in_lens[i], \
+				sizeof(Dtype) * in_lens[i], this->_y->getNumRows(), \
+				cudaMemcpyDeviceToDevice);
+	}
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+template <typename Dtype>
+void ConcatLayer<Dtype>::computeMultiDerivsOfInput( \
+		const vector<Matrix<Dtype>*>& dE_dxs){
+	const int out_len = this->_dE_dy->getNumCols();
+	const vector<int>& in_lens = _cp->getInLens();
+	for(int i = 0; i < dE_dxs.size(); i++){
+		if(dE_dxs[i] == NULL)
+			continue;
+		cudaMemcpy2D(dE_dxs[i]->getDevData(), sizeof(Dtype) * in_lens[i], \
+				this->_dE_dy->getDevData() + _offsets[i], sizeof(Dtype) * out_len, \
+				sizeof(Dtype) * in_lens[i], this->_dE_dy->getNumRows(), \
+				cudaMemcpyDeviceToDevice);
+	}
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
@@ -4,54 +4,151 @@
 
 
 #include <time.h>
+#include <fstream>
+#include <sstream>
 
 #include "convnet.hpp"
 #include "layer_kernel.cuh"
 
 using namespace std;
 
+string ConvAlgoCache::_file = "";
+bool ConvAlgoCache::_is_loaded = false;
+map<string, ConvAlgo> ConvAlgoCache::_algos;
+
+void ConvAlgoCache::setFile(const string& file){
+	_file = file;
+	_is_loaded = false;
+	_algos.clear();
+}
+
+/// 同一个key有多行时以最后一行为准
+void ConvAlgoCache::load(){
+	_is_loaded = true;
+	if(_file.empty())
+		return;
+	ifstream fin(_file.c_str());
+	string line;
+	while(getline(fin, line)){
+		istringstream iss(line);
+		int algo;
+		string key;
+		if(!(iss >> algo) || !getline(iss >> ws, key))
+			continue;
+		if(algo == CONV_DIRECT || algo == CONV_IM2COL)
+			_algos[key] = static_cast<ConvAlgo>(algo);
+	}
+}
+
+ConvAlgo ConvAlgoCache::find(const string& key){
+	if(!_is_loaded)
+		load();
+	map<string, ConvAlgo>::iterator it = _algos.find(key);
+	return it == _algos.end() ? CONV_AUTO : it->second;
+}
+
+/// 追加写入，几个进程同时测同一种形状时只是多几行相同的记录
+void ConvAlgoCache::save(const string& key, const ConvAlgo algo){
+	if(!_is_loaded)
+		load();
+	_algos[key] = algo;
+	if(_file.empty())
+		return;
+	ofstream fout(_file.c_str(), ios::app);
+	fout << algo << " " << key << endl;
+}
+
 template <typename Dtype>
 ConvNet<Dtype>::ConvNet(ConvParam* cp) : TrainLayer<Dtype>(cp){
 
 	this->_cp = cp;
 	this->_filt_pixs			= this->_cp->getFilterHeight()*_cp->getFilterWidth();
 	this->_conv_pixs			= this->_cp->getOutHeight()*_cp->getOutWidth();
-	this->_padded_in_pixs		= this->_cp->getPaddedInHeight()*cp->getPaddedInWidth();
 	this->_in_pixs				= this->_cp->getInHeight()*_cp->getInWidth();
-	this->_box_in_pixs			= this->_cp->getBoxInHeight()*_cp->getBoxInWidth();
-	cublasCreate(&this->handle);
 
+	this->_backward_thread		= MAX_NUM_THREAD;
+	this->_algo					= CONV_DIRECT;
+	this->_col					= NULL;
+	this->_col_imgs				= 0;
+	this->_is_fuse_relu			= false;
+
+	chooseBoxSize();
+	if(_cp->isTuned()){
+		setForwardConfig(_cp->getForwardConfig());
+		setBackwardConfig(_cp->getBackwardConfig());
+	}
+}
+
+/// 根据设备的共享内存和每个block最大线程数选择box大小，
+/// 大图被切成多个box，一个box的输入和一个权重必须放进共享内存
+template <typename Dtype>
+void ConvNet<Dtype>::chooseBoxSize(){
+
+	int device;
+	cudaDeviceProp prop;
+	cudaGetDevice(&device);
+	cudaGetDeviceProperties(&prop, device);
+
+	//每个SM至少留两个block同时驻留
+	_sh_mem_budget = prop.sharedMemPerBlock;
+	if(prop.sharedMemPerMultiprocessor / 2 < _sh_mem_budget)
+		_sh_mem_budget = prop.sharedMemPerMultiprocessor / 2;
+
+	_max_box_side = 1;
+	while((_max_box_side * 2) * (_max_box_side * 2) <= prop.maxThreadsPerBlock)
+		_max_box_side *= 2;
+
+	setBoxSide(_max_box_side);
+}
+
+/// 从边长为box_side的正方形开始，放不进共享内存时轮流把高和宽减半
+template <typename Dtype>
+void ConvNet<Dtype>::setBoxSide(const int box_side){
+
+	int box_out_height = box_side;
+	int box_out_width = box_side;
+	_cp->setBoxOutSize(box_out_height, box_out_width);
+	while(sizeof(Dtype)*(_filt_pixs + _cp->getBoxInHeight()*_cp->getBoxInWidth()) \
+			> _sh_mem_budget && (box_out_height > 1 || box_out_width > 1)){
+		if(box_out_height >= box_out_width)
+			box_out_height = (box_out_height + 1) / 2;
+		else
+			box_out_width = (box_out_width + 1) / 2;
+		_cp->setBoxOutSize(box_out_height, box_out_width);
+	}
+	assert(sizeof(Dtype)*(_filt_pixs + _cp->getBoxInHeight()*_cp->getBoxInWidth()) \
+			<= _sh_mem_budget);
+
+	_box_in_pixs = _cp->getBoxInHeight()*_cp->getBoxInWidth();
 	_num_box = _cp->getBoxNumHeight()*_cp->getBoxNumWidth();
 }
 
+template <typename Dtype>
+int ConvNet<Dtype>::getNumForwardConfig(){
+	if(_algo != CONV_DIRECT)
+		return 0;
+	int num_config = 0;
+	while((_max_box_side >> num_config) >= MIN_THREAD_SIZE)
+		num_config++;
+	return num_config;
+}
+
+template <typename Dtype>
+void ConvNet<Dtype>::setForwardConfig(const int idx){
+	setBoxSide(_max_box_side >> idx);
+}
+
 template <typename Dtype>
 ConvNet<Dtype>::~ConvNet() {
 
 	delete this->_w;
-	delete this->_w_inc;
 	delete this->_bias;
-	delete this->_bias_inc;
 
 	delete this->_y;
 	delete this->_dE_dy;
 	delete this->_dE_dw;
 	delete this->_dE_db;
-
-	delete unfold_x;
-	delete dE_db_tmp;
-	if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0)
-		delete padded_x;
-	if((_cp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _cp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_cp->getOverlapHeight() > 0 || _cp->getOverlapWidth() > 0))	
-		delete unranged_dE_dx;
-	if(_cp->getOutHeight() > MAX_THREAD_SIZE || _cp->getOutWidth() > MAX_THREAD_SIZE){
-		delete unranged_dE_dw;
-		delete unfold_dE_db_tmp;
-	}
-
-	cublasDestroy(this->handle);
-
+	delete _col;
 }
 
 template <typename Dtype>
@@ -68,233 +165,188 @@ void ConvNet<Dtype>::initCuda() {
 	this->_dE_dw          	= new Matrix<Dtype>(this->_w);
 	this->_dE_db           	= new Matrix<Dtype>(this->_bias);
 
-	this->_w_inc		 	= new Matrix<Dtype>(this->_w);
-	this->_bias_inc		 	= new Matrix<Dtype>(this->_bias);
+	chooseAlgo();
+}
 
-	if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0)
-		this->padded_x 		= new Matrix<Dtype>(this->_cp->getMinibatchSize(), \
-				this->_cp->getInChannel() * _padded_in_pixs);
-	unfold_x 		= new Matrix<Dtype>(this->_cp->getMinibatchSize(), \
-			this->_cp->getInChannel() * _padded_in_pixs);
+/// 形状、数据类型和设备都相同时最快的算法相同
+template <typename Dtype>
+string ConvNet<Dtype>::getAlgoKey(){
+	int device;
+	cudaDeviceProp prop;
+	cudaGetDevice(&device);
+	cudaGetDeviceProperties(&prop, device);
+
+	ostringstream oss;
+	oss << _cp->getMinibatchSize() << " " << _cp->getInChannel() << " " \
+		<< _cp->getInHeight() << " " << _cp->getInWidth() << " " \
+		<< _cp->getOutChannel() << " " << _cp->getFilterHeight() << " " \
+		<< _cp->getFilterWidth() << " " << _cp->getStrideHeight() << " " \
+		<< _cp->getStrideWidth() << " " << _cp->getPadHeight() << " " \
+		<< _cp->getPadWidth() << " " << sizeof(Dtype) << " " << prop.name;
+	return oss.str();
+}
 
-	if((_cp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _cp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_cp->getOverlapHeight() > 0 || _cp->getOverlapWidth() > 0)){
-		unranged_dE_dx = new Matrix<Dtype>(_cp->getMinibatchSize(), \
-				_box_in_pixs*_num_box*_cp->getOutChannel());
-	}
-	unranged_dE_dw = new Matrix<Dtype>(_cp->getMinibatchSize(), \
-			_filt_pixs*_cp->getInChannel()* \
-			_num_box*_cp->getOutChannel());
-
-	if(_cp->getOutHeight() > MAX_THREAD_SIZE \
-			|| _cp->getOutWidth() > MAX_THREAD_SIZE) {
-		unfold_dE_db_tmp		 = new Matrix<Dtype>(this->_cp->getMinibatchSize(), \
-				this->_cp->getOutChannel()*_num_box);
+/// 没有指定算法时先查缓存，没有记录再在临时输入上分别计时，结果写回缓存。
+/// 小图和输入channel多的层im2col后的矩阵乘更快，大图直接卷积不需要额外显存
+template <typename Dtype>
+void ConvNet<Dtype>::chooseAlgo(){
+
+	ConvAlgo algo = _cp->getConvAlgo();
+	if(algo == CONV_AUTO){
+		const string key = getAlgoKey();
+		algo = ConvAlgoCache::find(key);
+		if(algo == CONV_AUTO){
+			Matrix<Dtype>* x = new Matrix<Dtype>(_cp->getMinibatchSize(), \
+					_cp->getInChannel() * _in_pixs);
+			x->zeros();
+
+			_algo = CONV_DIRECT;
+			const float direct_time = this->timeComputation(x, NULL);
+			_algo = CONV_IM2COL;
+			createCol();
+			const float im2col_time = this->timeComputation(x, NULL);
+			delete x;
+
+			algo = im2col_time < direct_time ? CONV_IM2COL : CONV_DIRECT;
+			ConvAlgoCache::save(key, algo);
+			cout << _cp->getName() << " conv algo: direct " << direct_time \
+				<< "ms, im2col " << im2col_time << "ms" << endl;
+		}
+		///> 副本共享参数，不再重新选择
+		_cp->setConvAlgo(algo);
 	}
 
-	dE_db_tmp 				= new Matrix<Dtype>(this->_cp->getMinibatchSize(), \
-			this->_cp->getOutChannel());
+	_algo = algo;
+	if(_algo == CONV_IM2COL){
+		createCol();
+	}else{
+		delete _col;
+		_col = NULL;
+	}
+}
 
-	this->_w_inc->zeros();
-	this->_bias_inc->zeros();
+template <typename Dtype>
+void ConvNet<Dtype>::createCol(){
+	if(_col != NULL)
+		return;
+	const int img_len = _cp->getInChannel() * _filt_pixs * _conv_pixs;
+	_col_imgs = IM2COL_MAX_LEN / img_len;
+	if(_col_imgs > _cp->getMinibatchSize())
+		_col_imgs = _cp->getMinibatchSize();
+	if(_col_imgs < 1)
+		_col_imgs = 1;
+	_col = new Matrix<Dtype>(_col_imgs, img_len);
 }
 
 template <typename Dtype>
 void ConvNet<Dtype>::computeOutput(Matrix<Dtype>* x){
+	if(_algo == CONV_IM2COL)
+		computeOutputIm2col(x);
+	else
+		computeOutputDirect(x);
+}
 
-	this->_y->zeros();
+/// 每批_col_imgs张图片先展开，每张图的输出是w(out_channel行)乘展开矩阵，
+/// 按行存放的矩阵在cublas里是转置，所以算的是展开矩阵的转置乘w的转置
+template <typename Dtype>
+void ConvNet<Dtype>::computeOutputIm2col(Matrix<Dtype>* x){
+
+	const int minibatch = _cp->getMinibatchSize();
+	const int col_rows = _cp->getInChannel() * _filt_pixs;
+	const int in_len = _cp->getInChannel() * _in_pixs;
+	const int out_len = _cp->getOutChannel() * _conv_pixs;
+	const float alpha = 1.0f;
+	const float beta = 0.0f;
+	cublasHandle_t handle = Engine::getCublasHandle();
+
+	for(int n = 0; n < minibatch; n += _col_imgs){
+		const int num_img = minibatch - n < _col_imgs ? minibatch - n : _col_imgs;
+		const int num_kernel = num_img * col_rows * _conv_pixs;
+		im2col<<<this->getNumBlock(num_kernel, MAX_NUM_THREAD), MAX_NUM_THREAD>>>( \
+				x->getDevData() + n * in_len, _col->getDevData(), num_kernel, \
+				_cp->getInHeight(), _cp->getInWidth(), _cp->getInChannel(), \
+				_cp->getOutHeight(), _cp->getOutWidth(), \
+				_cp->getFilterHeight(), _cp->getFilterWidth(), \
+				_cp->getPadHeight(), _cp->getPadWidth(), \
+				_cp->getStrideHeight(), _cp->getStrideWidth());
+		cublasSgemmStridedBatched(handle, CUBLAS_OP_N, CUBLAS_OP_N, \
+				_conv_pixs, _cp->getOutChannel(), col_rows, &alpha, \
+				_col->getDevData(), _conv_pixs, col_rows * _conv_pixs, \
+				this->_w->getDevData(), col_rows, 0, &beta, \
+				this->_y->getDevData() + n * out_len, _conv_pixs, out_len, num_img);
+	}
 
-	int num_kernel;
-	int num_block;
+	const int num_out = this->_y->getNumEles();
+	add_conv_bias<<<this->getNumBlock(num_out, MAX_NUM_THREAD), MAX_NUM_THREAD>>>( \
+			this->_y->getDevData(), this->_bias->getDevData(), num_out, \
+			_conv_pixs, _cp->getOutChannel(), _is_fuse_relu);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
 
-	if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0){ 
-		num_kernel = this->_cp->getMinibatchSize() * _in_pixs \
-					 * this->_cp->getInChannel();
-		num_block = MAX_NUM_KERNEL < (num_kernel / MAX_NUM_THREAD + 1) \
-					? MAX_NUM_KERNEL : (num_kernel / MAX_NUM_THREAD + 1); 
-		padded_x->zeros();
-		ori_to_padding<<<num_block, MAX_NUM_THREAD>>>(x->getDevData(), \
-				padded_x->getDevData(), num_kernel, this->_cp->getInHeight(), \
-				_cp->getInWidth(), _cp->getPaddedInHeight(), \
-				_cp->getPaddedInWidth(), _cp->getInChannel());
-		cudaDeviceSynchronize();
-		cudaCheckError();
-	}else
-		padded_x = x;
+template <typename Dtype>
+void ConvNet<Dtype>::computeOutputDirect(Matrix<Dtype>* x){
 
-	dim3 blocks = dim3(_cp->getMinibatchSize(), _cp->getOutChannel()*_num_box);
-	dim3 threads = dim3(_cp->getThreadWidth(), _cp->getThreadHeight());
+	dim3 blocks = dim3(_cp->getOutChannel()*_num_box, _cp->getMinibatchSize());
+	dim3 threads = dim3(_cp->getBoxOutWidth(), _cp->getBoxOutHeight());
 
 
 	forward_convolution<<<blocks, threads, \
-		sizeof(Dtype)*(_cp->getInChannel()*_filt_pixs + _box_in_pixs)>>>(\
-				padded_x->getDevData(), this->_w->getDevData(), \
+		sizeof(Dtype)*(_filt_pixs + _box_in_pixs)>>>(\
+				x->getDevData(), this->_w->getDevData(), \
 				this->_bias->getDevData(), this->_y->getDevData(), \
-				_cp->getPaddedInHeight(), _cp->getPaddedInWidth(), \
+				_cp->getInHeight(), _cp->getInWidth(), \
 				_cp->getInChannel(), _cp->getOutHeight(), \
 				_cp->getOutWidth(), _cp->getFilterHeight(), \
 				_cp->getFilterWidth(), _cp->getOutChannel(), \
+				_cp->getPadHeight(), _cp->getPadWidth(), \
 				_cp->getStrideHeight(), _cp->getStrideWidth(), \
 				_cp->getBoxNumHeight(), _cp->getBoxNumWidth(), \
 				_cp->getBoxInHeight(), _cp->getBoxInWidth(), \
-				_cp->getBoxOutHeight(), _cp->getBoxOutWidth());
-	cudaDeviceSynchronize();
+				_cp->getBoxOutHeight(), _cp->getBoxOutWidth(), _is_fuse_relu);
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
 template <typename Dtype>
 void ConvNet<Dtype>::computeDerivsOfPars(Matrix<Dtype>* x){
 
-	dim3 blocks = dim3(_cp->getMinibatchSize() \
-			, _num_box \
-			*_cp->getFilterHeight()*_cp->getFilterWidth());
-
-	dim3 threads = dim3(_cp->getThreadWidth(), _cp->getThreadHeight());
-
-	unranged_dE_dw->zeros();
-
-	Dtype *dE_db_multi_channel;
-	if(_cp->getOutHeight() > MAX_THREAD_SIZE \
-			|| _cp->getOutWidth() > MAX_THREAD_SIZE) {
-		unfold_dE_db_tmp->zeros();
-		dE_db_multi_channel = unfold_dE_db_tmp->getDevData();
-
-	}else{
-		dE_db_tmp->zeros();
-		dE_db_multi_channel = dE_db_tmp->getDevData();
+	dim3 blocks = dim3(_cp->getInChannel()*_filt_pixs, _cp->getOutChannel());
 
-	}
-
-	compute_convolution_derivs<<<blocks, threads, \
-		sizeof(Dtype)*(_cp->getBoxOutHeight()*_cp->getBoxOutWidth())>>>( \
-				this->_dE_dy->getDevData(), padded_x->getDevData(), \
-				unranged_dE_dw->getDevData(), \
-				_cp->getBoxOutHeight(), _cp->getBoxOutWidth(), \
+	compute_convolution_derivs<<<blocks, REDUCE_BLOCK_SIZE>>>( \
+				this->_dE_dy->getDevData(), x->getDevData(), \
+				this->_dE_dw->getDevData(), _cp->getMinibatchSize(), \
 				_cp->getOutChannel(), _cp->getInChannel(), \
-				_cp->getPaddedInHeight(), _cp->getPaddedInWidth(), \
+				_cp->getInHeight(), _cp->getInWidth(), \
 				_cp->getOutHeight(), _cp->getOutWidth(), \
 				_cp->getFilterHeight(), _cp->getFilterWidth(), \
-				_cp->getStrideHeight(), _cp->getStrideWidth(), \
-				_cp->getBoxNumHeight(), _cp->getBoxNumWidth());
-
-	cudaDeviceSynchronize();
+				_cp->getPadHeight(), _cp->getPadWidth(), \
+				_cp->getStrideHeight(), _cp->getStrideWidth());
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 
-	blocks = dim3(_cp->getMinibatchSize(), _cp->getOutChannel()*_num_box);
-	compute_derivs_of_bias<<<blocks, threads, \
-		sizeof(Dtype)*_cp->getBoxOutHeight()*_cp->getBoxOutWidth()>>>( \
-				this->_dE_dy->getDevData(), dE_db_multi_channel, \
-				_cp->getOutHeight(), _cp->getOutWidth(), \
-				_cp->getOutChannel(), \
-				_cp->getBoxOutHeight(), _cp->getBoxOutWidth(), \
-				_cp->getBoxNumHeight(), _cp->getBoxNumWidth());
-
-	cudaDeviceSynchronize();
-	cudaCheckError();
-
-	blocks = dim3(1, _cp->getInChannel()*_cp->getOutChannel());
-	compact_dervis_w<<<blocks, threads, 0>>>( \
-			unranged_dE_dw->getDevData(), this->_dE_dw->getDevData(), \
-			_cp->getFilterHeight(), _cp->getFilterWidth(), \
-			_cp->getBoxNumHeight(), _cp->getBoxNumWidth(), \
-			_cp->getMinibatchSize(), _cp->getInChannel(), _cp->getOutChannel());
-	cudaDeviceSynchronize();
-	cudaCheckError();
-	if(_cp->getOutHeight() > MAX_THREAD_SIZE \
-			|| _cp->getOutWidth() > MAX_THREAD_SIZE) {
-		blocks = dim3(_cp->getMinibatchSize(), _cp->getOutChannel());
-		compute_derivs_of_bias<<<blocks, threads, sizeof(Dtype)*_num_box>>>( \
-				unfold_dE_db_tmp->getDevData(), dE_db_tmp->getDevData(), \
-				_cp->getBoxNumHeight(), _cp->getBoxNumWidth(), \
-				_cp->getOutChannel(), _cp->getBoxNumHeight(), \
-				_cp->getBoxNumWidth(), 1, 1);
-	}
-	cudaDeviceSynchronize();
+	compute_derivs_of_bias<<<_cp->getOutChannel(), REDUCE_BLOCK_SIZE>>>( \
+				this->_dE_dy->getDevData(), this->_dE_db->getDevData(), \
+				_cp->getMinibatchSize(), _conv_pixs, _cp->getOutChannel());
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 
-	dE_db_tmp->sumRow(this->_dE_db);
-
 }
 
 template <typename Dtype>
 void ConvNet<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
 
+	int num_kernel = dE_dx->getNumEles();
+	int num_block = this->getNumBlock(num_kernel, _backward_thread);
 
-	dim3 blocks = dim3(_cp->getMinibatchSize(), _cp->getInChannel() * _num_box);
-	dim3 threads = dim3(_cp->getThreadWidth(), _cp->getThreadHeight());
-
-	int box_in_height = MAX_THREAD_SIZE > _cp->getOutHeight() \
-						? _cp->getPaddedInHeight() : _cp->getBoxInHeight();
-	int box_in_width = MAX_THREAD_SIZE > _cp->getOutWidth() \
-					   ? _cp->getPaddedInWidth() : _cp->getBoxInWidth();
-
-	Dtype* p_dE_dx;
-	if((_cp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _cp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_cp->getOverlapHeight() > 0 || _cp->getOverlapWidth() > 0)){
-		unranged_dE_dx->zeros();
-		p_dE_dx = unranged_dE_dx->getDevData();
-
-	}else if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0){
-		unfold_x->zeros();
-		p_dE_dx = unfold_x->getDevData();
-
-	}else{
-		dE_dx->zeros();
-		p_dE_dx = dE_dx->getDevData();
-
-	}
-
-	backward_convolution<<<blocks, threads, \
-		sizeof(Dtype)*box_in_height*box_in_width>>>( \
+	backward_convolution<<<num_block, _backward_thread>>>( \
 				this->_dE_dy->getDevData(), this->_w->getDevData(), \
-				p_dE_dx, box_in_height, box_in_width, \
-				_cp->getBoxOutHeight(), _cp->getBoxOutWidth(), \
-				_cp->getOutChannel(), _cp->getInChannel(), \
-				_cp->getOutHeight(), _cp->getOutWidth(), \
+				dE_dx->getDevData(), num_kernel, \
+				_cp->getInHeight(), _cp->getInWidth(), _cp->getInChannel(), \
+				_cp->getOutHeight(), _cp->getOutWidth(), _cp->getOutChannel(), \
 				_cp->getFilterHeight(), _cp->getFilterWidth(), \
-				_cp->getStrideHeight(), _cp->getStrideWidth(), \
-				_cp->getBoxNumHeight(), _cp->getBoxNumWidth());
-	cudaDeviceSynchronize();
+				_cp->getPadHeight(), _cp->getPadWidth(), \
+				_cp->getStrideHeight(), _cp->getStrideWidth());
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
-
-	if((_cp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _cp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_cp->getOverlapHeight() > 0 || _cp->getOverlapWidth() > 0)){
-
-		if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0){
-			unfold_x->zeros();
-			p_dE_dx = unfold_x->getDevData();
-
-		}else{
-			dE_dx->zeros();
-			p_dE_dx = dE_dx->getDevData();
-
-		}
-
-		compactOverlap<<<_cp->getMinibatchSize(), _cp->getInChannel()>>>( \
-				unranged_dE_dx->getDevData(), p_dE_dx, \
-				_cp->getPaddedInHeight(), _cp->getPaddedInWidth(), \
-				_cp->getInChannel(),  _cp->getOverlapHeight(), _cp->getOverlapWidth(), \
-				box_in_height, box_in_width, \
-				_cp->getBoxNumHeight(), _cp->getBoxNumWidth());
-		cudaDeviceSynchronize();
-		cudaCheckError();
-	}
-
-
-	if(_cp->getPadHeight() > 0 || _cp->getPadWidth() > 0){
-		int num_kernel = this->_cp->getMinibatchSize() * _in_pixs \
-						 * this->_cp->getInChannel();
-		int num_block = MAX_NUM_KERNEL < (num_kernel / MAX_NUM_THREAD + 1) \
-						? MAX_NUM_KERNEL : (num_kernel / MAX_NUM_THREAD + 1);
-		pad_to_ori<<<num_block, MAX_NUM_THREAD>>>(dE_dx->getDevData(), \
-				p_dE_dx, num_kernel, _cp->getInHeight(), _cp->getInWidth(), \
-				_cp->getPaddedInHeight(), _cp->getPaddedInWidth(), \
-				_cp->getInChannel());
-		cudaDeviceSynchronize();
-		cudaCheckError();
-
-	}
 }
@@ -9,6 +9,8 @@ template <typename Dtype>
 DropoutLayer<Dtype>::DropoutLayer(Param* p){
 
 	this->_p           = p;
+	_seed              = 0;
+	_step              = 0;
 }
 
 template <typename Dtype>
@@ -16,7 +18,6 @@ DropoutLayer<Dtype>::~DropoutLayer() {
 	delete  this->_y; 
 	delete  this->_dE_dy;
 	delete  _drop_record;
-	delete  _drop_rand_probs;
 
 }
 
@@ -35,18 +36,13 @@ void DropoutLayer<Dtype>::initCuda() {
 	this->_y             = new Matrix<Dtype>(_p->getMinibatchSize(), col);
 	this->_dE_dy         = new Matrix<Dtype>(this->_y);
 	_drop_record		 = new Matrix<int>(_p->getMinibatchSize(), col);
-	_drop_rand_probs     = new Matrix<curandState>(_p->getMinibatchSize(), col);
-	_is_set_up 			 = false;
 }
 
 template <typename Dtype>
 void DropoutLayer<Dtype>::computeOutput(Matrix<Dtype>* x){ 
 	
-	x->applyDropout(this->_y, _drop_record, _drop_rand_probs, _is_set_up);
-	
-	if(_is_set_up == false)
-		_is_set_up = true;
-	
+	x->applyDropout(this->_y, _drop_record, _seed, _step);
+	_step++;
 
 }
 
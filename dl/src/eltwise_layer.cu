@@ -0,0 +1,62 @@
+///
+/// \file eltwise_layer.cu
+/// @brief
+
+#include "eltwise_layer.hpp"
+
+using namespace std;
+
+template <typename Dtype>
+EltwiseSumLayer<Dtype>::EltwiseSumLayer(Param* fcp){
+
+	this->_fcp           = fcp;
+}
+
+template <typename Dtype>
+EltwiseSumLayer<Dtype>::~EltwiseSumLayer() {
+	delete  this->_y; 
+	delete  this->_dE_dy;
+}
+
+template <typename Dtype>
+void EltwiseSumLayer<Dtype>::initCuda() {
+
+	this->_y             = new Matrix<Dtype>(_fcp->getMinibatchSize(), \
+								_fcp->getNumOut());
+	this->_dE_dy         = new Matrix<Dtype>(this->_y);
+}
+
+template <typename Dtype>
+void EltwiseSumLayer<Dtype>::computeOutput(Matrix<Dtype>* x){ 
+	this->_y->copyFromDevice(x);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+template <typename Dtype>
+void EltwiseSumLayer<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
+	dE_dx->copyFromDevice(this->_dE_dy);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+template <typename Dtype>
+void EltwiseSumLayer<Dtype>::computeMultiOutput(const vector<Matrix<Dtype>*>& xs){ 
+	this->_y->copyFromDevice(xs[0]);
+	for(int i = 1; i < xs.size(); i++)
+		this->_y->add(xs[i], 1, 1);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+/// 每个输入的导数都等于输出的导数
+template <typename Dtype>
+void EltwiseSumLayer<Dtype>::computeMultiDerivsOfInput( \
+		const vector<Matrix<Dtype>*>& dE_dxs){
+	for(int i = 0; i < dE_dxs.size(); i++){
+		if(dE_dxs[i] != NULL)
+			dE_dxs[i]->copyFromDevice(this->_dE_dy);
+	}
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
@@ -0,0 +1,428 @@
+///
+/// \file engine.cpp
+/// @brief
+
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <iostream>
+#include "engine.hpp"
+
+#define MPOL_PREFERRED_MODE 1   ///>mbind的MPOL_PREFERRED，节点内存不够时可以落到其他节点
+#define HOST_ALLOC_HEADER 64   ///>allocHost返回的地址前面保存映射的长度，保持64字节对齐
+
+using namespace std;
+
+///> 池里的线程在_queues中的下标，池外线程是-1
+static __thread int tls_worker_idx = -1;
+static __thread cublasHandle_t tls_cublas_handle = NULL;
+
+int Engine::_init_num_thread = 0;
+bool Engine::_init_is_pin = false;
+int Engine::_init_node = -1;
+vector< vector<int> > Engine::_init_node_cpus;
+
+int TaskGraph::addTask(TaskFunc func, void* arg, const vector<int>& deps){
+	Node node;
+	node.func = func;
+	node.arg = arg;
+	node.graph = this;
+	node.num_deps = deps.size();
+	node.num_pending = 0;
+	_nodes.push_back(node);
+
+	const int idx = _nodes.size() - 1;
+	for (int i = 0; i < deps.size(); ++i)
+		_nodes[deps[i]].successors.push_back(idx);
+	return idx;
+}
+
+Engine* Engine::getInstance(){
+	///> 第一次调用时构造，程序退出时析构
+	static Engine engine(_init_num_thread);
+	return &engine;
+}
+
+void Engine::setNumThread(const int num_thread){
+	_init_num_thread = num_thread;
+}
+
+void Engine::setNuma(const bool is_pin, const int node, \
+		const vector< vector<int> >& node_cpus){
+	_init_is_pin = is_pin;
+	_init_node = node;
+	_init_node_cpus = node_cpus;
+}
+
+cublasHandle_t Engine::getCublasHandle(){
+	if (tls_cublas_handle == NULL) {
+		cublasCreate(&tls_cublas_handle);
+		cublasSetStream(tls_cublas_handle, cudaStreamPerThread);
+		Engine* engine = getInstance();
+		pthread_mutex_lock(&engine->_handle_mutex);
+		engine->_handles.push_back(tls_cublas_handle);
+		pthread_mutex_unlock(&engine->_handle_mutex);
+	}
+	return tls_cublas_handle;
+}
+
+Engine::Engine(const int num_thread){
+	_is_pin = _init_is_pin;
+	_node_cpus = _init_node_cpus;
+	if (_node_cpus.size() == 0)
+		readTopology();
+	_node = _init_node >= 0 ? _init_node : getDeviceNode();
+	if (_node >= (int)_node_cpus.size())
+		_node = -1;
+
+	if (_node >= 0) {
+		_pin_cpus = _node_cpus[_node];
+	} else {
+		///> 不区分节点时交替取各节点的核，前几个线程分散在所有socket上
+		for (int i = 0; ; ++i) {
+			bool has_cpu = false;
+			for (int n = 0; n < _node_cpus.size(); ++n) {
+				if (i < _node_cpus[n].size()) {
+					_pin_cpus.push_back(_node_cpus[n][i]);
+					has_cpu = true;
+				}
+			}
+			if (!has_cpu)
+				break;
+		}
+	}
+
+	///> 默认每个可用的核一个线程，调用线程占一个
+	_num_thread = num_thread;
+	if (_num_thread <= 0)
+		_num_thread = _pin_cpus.size() - 1;
+	if (_num_thread < 0)
+		_num_thread = 0;
+	cout << "host threads: " << _num_thread << ", numa nodes: " << _node_cpus.size() \
+		<< ", local node: " << _node << (_is_pin ? ", pinned" : "") << endl;
+	_is_started = false;
+	_is_stop = false;
+	_num_queued = 0;
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+	pthread_mutex_init(&_handle_mutex, NULL);
+
+	for (int i = 0; i <= _num_thread; ++i) {
+		WorkQueue* queue = new WorkQueue;
+		pthread_mutex_init(&queue->mutex, NULL);
+		_queues.push_back(queue);
+	}
+}
+
+Engine::~Engine(){
+	pthread_mutex_lock(&_mutex);
+	_is_stop = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	for (int i = 0; i < _threads.size(); ++i)
+		pthread_join(_threads[i], NULL);
+
+	for (int i = 0; i < _queues.size(); ++i) {
+		pthread_mutex_destroy(&_queues[i]->mutex);
+		delete _queues[i];
+	}
+	for (int i = 0; i < _handles.size(); ++i)
+		cublasDestroy(_handles[i]);
+	pthread_mutex_destroy(&_handle_mutex);
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+void Engine::start(){
+	pthread_mutex_lock(&_mutex);
+	if (!_is_started) {
+		_threads.resize(_num_thread);
+		for (int i = 0; i < _num_thread; ++i)
+			pthread_create(&_threads[i], NULL, runWorker, this);
+		_is_started = true;
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void* Engine::runWorker(void* engine){
+	Engine* e = static_cast<Engine*>(engine);
+	///> 按创建顺序取下标
+	static int num_created = 0;
+	e->workerLoop(__sync_fetch_and_add(&num_created, 1));
+	return NULL;
+}
+
+void Engine::workerLoop(const int idx){
+	tls_worker_idx = idx;
+	if (_is_pin && _pin_cpus.size() > 0) {
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(_pin_cpus[idx % _pin_cpus.size()], &cpu_set);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+	}
+	while (true) {
+		Task task;
+		if (pop(task)) {
+			task.func(task.arg);
+			continue;
+		}
+		pthread_mutex_lock(&_mutex);
+		while (__sync_fetch_and_add(&_num_queued, 0) == 0 && !_is_stop)
+			pthread_cond_wait(&_cond, &_mutex);
+		const bool is_stop = _is_stop && __sync_fetch_and_add(&_num_queued, 0) == 0;
+		pthread_mutex_unlock(&_mutex);
+		if (is_stop)
+			break;
+	}
+}
+
+void Engine::push(const Task& task){
+	WorkQueue* queue = _queues[tls_worker_idx >= 0 ? tls_worker_idx : _num_thread];
+	pthread_mutex_lock(&queue->mutex);
+	queue->tasks.push_back(task);
+	pthread_mutex_unlock(&queue->mutex);
+
+	///> 先增加计数再在锁里唤醒，等待的线程在锁里检查计数，不会漏掉
+	__sync_fetch_and_add(&_num_queued, 1);
+	pthread_mutex_lock(&_mutex);
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+/// 先从自己队列的尾部取，最近放进去的任务数据还在缓存里，
+/// 再从其他队列的头部偷，偷到的是较早提交的、通常更大的任务
+bool Engine::pop(Task& task){
+	const int num_queue = _queues.size();
+	const int self = tls_worker_idx >= 0 ? tls_worker_idx : _num_thread;
+
+	WorkQueue* queue = _queues[self];
+	pthread_mutex_lock(&queue->mutex);
+	if (!queue->tasks.empty()) {
+		task = queue->tasks.back();
+		queue->tasks.pop_back();
+		pthread_mutex_unlock(&queue->mutex);
+		__sync_fetch_and_sub(&_num_queued, 1);
+		return true;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	for (int i = 1; i < num_queue; ++i) {
+		queue = _queues[(self + i) % num_queue];
+		pthread_mutex_lock(&queue->mutex);
+		if (!queue->tasks.empty()) {
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+			pthread_mutex_unlock(&queue->mutex);
+			__sync_fetch_and_sub(&_num_queued, 1);
+			return true;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	return false;
+}
+
+void Engine::helpUntil(volatile int* num_remain){
+	while (__sync_fetch_and_add(num_remain, 0) > 0) {
+		Task task;
+		if (pop(task))
+			task.func(task.arg);
+		else
+			sched_yield();
+	}
+}
+
+void Engine::runRange(void* range_task){
+	RangeTask* rt = static_cast<RangeTask*>(range_task);
+	rt->func(rt->arg, rt->begin, rt->end);
+	__sync_fetch_and_sub(rt->num_remain, 1);
+}
+
+void Engine::parallelFor(const int begin, const int end, const int grain, \
+		RangeFunc func, void* arg){
+	if (end <= begin)
+		return;
+	const int step = grain > 0 ? grain : 1;
+	const int num_range = (end - begin + step - 1) / step;
+	if (num_range == 1 || _num_thread == 0) {
+		func(arg, begin, end);
+		return;
+	}
+	start();
+
+	volatile int num_remain = num_range - 1;
+	vector<RangeTask> ranges(num_range);
+	for (int i = 0; i < num_range; ++i) {
+		ranges[i].func = func;
+		ranges[i].arg = arg;
+		ranges[i].begin = begin + i * step;
+		ranges[i].end = min(begin + (i + 1) * step, end);
+		ranges[i].num_remain = &num_remain;
+	}
+	///> 倒着放，自己从尾部先取到的是靠前的段，被偷走的是靠后的段
+	for (int i = num_range - 1; i >= 1; --i) {
+		Task task = {runRange, &ranges[i]};
+		push(task);
+	}
+	func(arg, ranges[0].begin, ranges[0].end);
+	helpUntil(&num_remain);
+}
+
+void Engine::runNode(void* node){
+	TaskGraph::Node* n = static_cast<TaskGraph::Node*>(node);
+	n->func(n->arg);
+
+	TaskGraph* graph = n->graph;
+	Engine* engine = getInstance();
+	for (int i = 0; i < n->successors.size(); ++i) {
+		TaskGraph::Node* next = &graph->_nodes[n->successors[i]];
+		if (__sync_sub_and_fetch(&next->num_pending, 1) == 0) {
+			Task task = {runNode, next};
+			engine->push(task);
+		}
+	}
+	__sync_fetch_and_sub(&graph->_num_remain, 1);
+}
+
+void Engine::run(TaskGraph* graph){
+	vector<TaskGraph::Node>& nodes = graph->_nodes;
+	if (nodes.size() == 0)
+		return;
+	start();
+
+	graph->_num_remain = nodes.size();
+	for (int i = 0; i < nodes.size(); ++i)
+		nodes[i].num_pending = nodes[i].num_deps;
+	__sync_synchronize();
+	for (int i = 0; i < nodes.size(); ++i) {
+		if (nodes[i].num_deps == 0) {
+			Task task = {runNode, &nodes[i]};
+			push(task);
+		}
+	}
+	helpUntil(&graph->_num_remain);
+}
+
+/// 列表格式和/sys里的一样，例如"0-3,8-11"
+void Engine::parseCpuList(const string& list, vector<int>& cpus){
+	const char* p = list.c_str();
+	while (*p != '\0') {
+		if (!isdigit(*p)) {
+			++p;
+			continue;
+		}
+		char* end;
+		const int first = strtol(p, &end, 10);
+		int last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (int i = first; i <= last; ++i)
+			cpus.push_back(i);
+		p = end;
+	}
+}
+
+static bool readLine(const string& file, string& line){
+	FILE* fp = fopen(file.c_str(), "r");
+	if (fp == NULL)
+		return false;
+	char buf[4096];
+	const bool is_read = fgets(buf, sizeof(buf), fp) != NULL;
+	fclose(fp);
+	if (is_read)
+		line = buf;
+	return is_read;
+}
+
+void Engine::readTopology(){
+	string line;
+	vector<int> nodes;
+	if (readLine("/sys/devices/system/node/online", line))
+		parseCpuList(line, nodes);
+	for (int i = 0; i < nodes.size(); ++i) {
+		char file[128];
+		sprintf(file, "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+		if (!readLine(file, line))
+			continue;
+		if (nodes[i] >= _node_cpus.size())
+			_node_cpus.resize(nodes[i] + 1);
+		parseCpuList(line, _node_cpus[nodes[i]]);
+	}
+
+	///> 没有numa信息时当成一个节点
+	if (_node_cpus.size() == 0) {
+		_node_cpus.resize(1);
+		const int num_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int i = 0; i < num_cpu; ++i)
+			_node_cpus[0].push_back(i);
+	}
+}
+
+int Engine::getDeviceNode(){
+	int device;
+	char bus_id[32];
+	if (cudaGetDevice(&device) != cudaSuccess \
+			|| cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), device) != cudaSuccess)
+		return -1;
+	for (char* p = bus_id; *p != '\0'; ++p)
+		*p = tolower(*p);
+
+	string line;
+	if (!readLine(string("/sys/bus/pci/devices/") + bus_id + "/numa_node", line))
+		return -1;
+	return atoi(line.c_str());
+}
+
+void Engine::pinThread(){
+	if (!_is_pin || _node < 0)
+		return;
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (int i = 0; i < _pin_cpus.size(); ++i)
+		CPU_SET(_pin_cpus[i], &cpu_set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+}
+
+void Engine::touchRange(void* ptr, const int begin, const int end){
+	const long page_size = sysconf(_SC_PAGESIZE);
+	char* p = static_cast<char*>(ptr);
+	for (int i = begin; i < end; ++i)
+		p[i * page_size] = 0;
+}
+
+void* Engine::allocHost(const size_t size){
+	const long page_size = sysconf(_SC_PAGESIZE);
+	const size_t len = (size + HOST_ALLOC_HEADER + page_size - 1) / page_size * page_size;
+	void* base = mmap(NULL, len, PROT_READ | PROT_WRITE, \
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		cerr << "can not allocate " << size << " bytes of host memory." << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (_node >= 0 && _node < sizeof(unsigned long) * 8) {
+		unsigned long node_mask = 1UL << _node;
+		syscall(SYS_mbind, base, len, MPOL_PREFERRED_MODE, &node_mask, \
+				sizeof(node_mask) * 8, 0);
+	}
+
+	///> 池线程绑定在本节点上，由它们第一次写每一页
+	const int num_page = len / page_size;
+	if (_is_pin)
+		parallelFor(0, num_page, HOST_GRAIN_SIZE / 16, touchRange, base);
+	else
+		touchRange(base, 0, num_page);
+
+	*static_cast<size_t*>(base) = len;
+	return static_cast<char*>(base) + HOST_ALLOC_HEADER;
+}
+
+void Engine::freeHost(void* ptr){
+	if (ptr == NULL)
+		return;
+	char* base = static_cast<char*>(ptr) - HOST_ALLOC_HEADER;
+	munmap(base, *reinterpret_cast<size_t*>(base));
+}
@@ -10,56 +10,76 @@ template <typename Dtype>
 InnerProductLayer<Dtype>::InnerProductLayer<Dtype>(InnerParam* fcp) : \
  	TrainLayer<Dtype>((TrainParam*)fcp){
 	this->_fcp = fcp;
-	cublasCreate(&this->handle);
+	_comm = NULL;
+	_ones = NULL;
+	_h_y = NULL;
+	_h_dE_dx = NULL;
+	data_T = NULL;
+	w_T = NULL;
 }
 
 template <typename Dtype>
 InnerProductLayer<Dtype>::~InnerProductLayer<Dtype>() {
 
 	delete this->_w; 
-	delete this->_w_inc;
 	delete this->_bias;
-	delete this->_bias_inc;
 
 	delete this->_y; 
 	delete this->_dE_dy;
 	delete this->_dE_db;
 	delete this->_dE_dw;
-	
-	cublasDestroy(this->handle);
+
+	delete data_T;
+	delete w_T;
+	delete _ones;
+	Engine::getInstance()->freeHost(_h_y);
+	Engine::getInstance()->freeHost(_h_dE_dx);
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::initCuda() {
 
-	this->_w            = new Matrix<Dtype>(this->_fcp->getNumIn(), this->_fcp->getNumOut());
-	this->_bias         = new Matrix<Dtype>(1, this->_fcp->getNumOut());
+	///> 切分时w和bias只有本进程的几列，输出仍然是完整的
+	const int num_out = isSharded() ? _fcp->getShardNumOut() : _fcp->getNumOut();
+	this->_w            = new Matrix<Dtype>(this->_fcp->getNumIn(), num_out);
+	this->_bias         = new Matrix<Dtype>(1, num_out);
 
 	this->_y            = new Matrix<Dtype>(this->_fcp->getMinibatchSize(), this->_fcp->getNumOut());
 	
 	this->_dE_dy        = new Matrix<Dtype>(this->_y);
 	this->_dE_db        = new Matrix<Dtype>(this->_bias);
 	this->_dE_dw        = new Matrix<Dtype>(this->_w);
-
-	this->_w_inc        = new Matrix<Dtype>(this->_w);
-	this->_bias_inc     = new Matrix<Dtype>(this->_bias);
 	
-	data_T = new Matrix<Dtype>(_fcp->getNumIn(), _fcp->getMinibatchSize());
-	w_T = new Matrix<Dtype>(this->_w->getNumCols(), this->_w->getNumRows());
-
-	this->_w_inc->zeros();
-	this->_bias_inc->zeros();
+	///> 切分时用cublas的转置参数，不需要转置的临时矩阵
+	if(!isSharded()){
+		data_T = new Matrix<Dtype>(_fcp->getNumIn(), _fcp->getMinibatchSize());
+		w_T = new Matrix<Dtype>(this->_w->getNumCols(), this->_w->getNumRows());
+	}else{
+		const int minibatch = _fcp->getMinibatchSize();
+		_ones = new Matrix<Dtype>(1, minibatch);
+		_ones->reValue(1.0f);
+		_h_y = static_cast<Dtype*>(Engine::getInstance()->allocHost( \
+					sizeof(Dtype) * minibatch * _fcp->getNumOut()));
+		_h_dE_dx = static_cast<Dtype*>(Engine::getInstance()->allocHost( \
+					sizeof(Dtype) * minibatch * _fcp->getNumIn()));
+		for(int r = 0; r <= _fcp->getNumShard(); r++)
+			_gather_starts.push_back(minibatch * _fcp->getShardStart(r));
+	}
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::computeOutput(Matrix<Dtype>* x){ 
+	if(isSharded()){
+		computeShardOutput(x);
+		return;
+	}
 //	x->showValue("data");
 //	this->_w->showValue("w");
 
 //	x->reValue(512);
 //	this->_w->reValue(1.0f);
 
-	x->rightMult(this->_w, 1, this->_y, this->handle);
+	x->rightMult(this->_w, 1, this->_y, Engine::getCublasHandle());
 	this->_y->addRowVector(this->_bias);
 //	this->_y->showValue("yj1");
 
@@ -68,14 +88,17 @@ void InnerProductLayer<Dtype>::computeOutput(Matrix<Dtype>* x){
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::computeDerivsOfPars(Matrix<Dtype>* x){
-
+	if(isSharded()){
+		computeShardDerivsOfPars(x);
+		return;
+	}
 	
 //	x->reValue(512);
 //	this->_dE_dy->reValue(1.0f);
 
 	x->getTranspose(data_T);
 
-	data_T->rightMult(this->_dE_dy, 1, this->_dE_dw, this->handle);
+	data_T->rightMult(this->_dE_dy, 1, this->_dE_dw, Engine::getCublasHandle());
 	this->_dE_dy->sumRow(this->_dE_db);
 
 //this->_dE_dw->showValue("dedwinner");
@@ -84,14 +107,107 @@ void InnerProductLayer<Dtype>::computeDerivsOfPars(Matrix<Dtype>* x){
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
+	if(isSharded()){
+		///> 输入是数据时没有输入导数，所有进程的图相同，都不做这次allreduce
+		if(dE_dx != NULL)
+			computeShardDerivsOfInput(dE_dx);
+		return;
+	}
 
 //	this->_w->reValue(1.0f);
 //	this->_dE_dy->reValue(64);
 
 	this->_w->getTranspose(w_T);
-	this->_dE_dy->rightMult(w_T, 1, dE_dx, this->handle);
+	this->_dE_dy->rightMult(w_T, 1, dE_dx, Engine::getCublasHandle());
 //dE_dx->showValue("innerdedx");
 
 
 }
 
+//下面的矩阵都是行主的，按cublas的列主看是转置，
+//_y和_dE_dy中本进程的几列是行距为num_out的(minibatch, shard_out)矩阵
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::computeShardOutput(Matrix<Dtype>* x){
+	///> 参数导数和输入导数在不同线程上计算，各自使用调用线程的句柄和stream
+	cublasHandle_t handle = Engine::getCublasHandle();
+	const int num_in = _fcp->getNumIn();
+	const int num_out = _fcp->getNumOut();
+	const int minibatch = _fcp->getMinibatchSize();
+	const int shard_idx = _fcp->getShardIdx();
+	const int shard_out = _fcp->getShardNumOut();
+	Dtype* y = this->_y->getDevData() + _fcp->getShardStart(shard_idx);
+	const float one = 1;
+	const float zero = 0;
+
+	///> y = x*w + 1*bias^T，直接写进_y的本进程几列
+	cublasSgemm(handle, CUBLAS_OP_N, CUBLAS_OP_N, shard_out, minibatch, \
+			num_in, &one, this->_w->getDevData(), shard_out, \
+			x->getDevData(), num_in, &zero, y, num_out);
+	cublasSger(handle, shard_out, minibatch, &one, \
+			this->_bias->getDevData(), 1, _ones->getDevData(), 1, y, num_out);
+
+	cudaMemcpy2D(_h_y + _gather_starts[shard_idx], sizeof(Dtype) * shard_out, \
+			y, sizeof(Dtype) * num_out, sizeof(Dtype) * shard_out, minibatch, \
+			cudaMemcpyDeviceToHost);
+	_comm->allGather(_h_y, _gather_starts);
+	for(int r = 0; r < _fcp->getNumShard(); r++){
+		if(r == shard_idx)
+			continue;
+		const int start = _fcp->getShardStart(r);
+		const int len = _fcp->getShardStart(r + 1) - start;
+		cudaMemcpy2D(this->_y->getDevData() + start, sizeof(Dtype) * num_out, \
+				_h_y + _gather_starts[r], sizeof(Dtype) * len, \
+				sizeof(Dtype) * len, minibatch, cudaMemcpyHostToDevice);
+	}
+	cudaCheckError();
+}
+
+/// 只需要dE_dy中本进程的几列，不需要通信
+template <typename Dtype>
+void InnerProductLayer<Dtype>::computeShardDerivsOfPars(Matrix<Dtype>* x){
+	///> 参数导数和输入导数在不同线程上计算，各自使用调用线程的句柄和stream
+	cublasHandle_t handle = Engine::getCublasHandle();
+	const int num_in = _fcp->getNumIn();
+	const int num_out = _fcp->getNumOut();
+	const int minibatch = _fcp->getMinibatchSize();
+	const int shard_out = _fcp->getShardNumOut();
+	const Dtype* dE_dy = this->_dE_dy->getDevData() \
+						 + _fcp->getShardStart(_fcp->getShardIdx());
+	const float one = 1;
+	const float zero = 0;
+
+	///> dE_dw = x^T*dE_dy，dE_db = dE_dy^T*1
+	cublasSgemm(handle, CUBLAS_OP_N, CUBLAS_OP_T, shard_out, num_in, \
+			minibatch, &one, dE_dy, num_out, x->getDevData(), num_in, \
+			&zero, this->_dE_dw->getDevData(), shard_out);
+	cublasSgemv(handle, CUBLAS_OP_N, shard_out, minibatch, &one, \
+			dE_dy, num_out, _ones->getDevData(), 1, \
+			&zero, this->_dE_db->getDevData(), 1);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+/// 每个进程用自己的几列算出dE_dx的部分和，allreduce以后是完整的
+template <typename Dtype>
+void InnerProductLayer<Dtype>::computeShardDerivsOfInput(Matrix<Dtype>* dE_dx){
+	///> 参数导数和输入导数在不同线程上计算，各自使用调用线程的句柄和stream
+	cublasHandle_t handle = Engine::getCublasHandle();
+	const int num_in = _fcp->getNumIn();
+	const int num_out = _fcp->getNumOut();
+	const int minibatch = _fcp->getMinibatchSize();
+	const int shard_out = _fcp->getShardNumOut();
+	const Dtype* dE_dy = this->_dE_dy->getDevData() \
+						 + _fcp->getShardStart(_fcp->getShardIdx());
+	const float one = 1;
+	const float zero = 0;
+
+	///> dE_dx = dE_dy*w^T
+	cublasSgemm(handle, CUBLAS_OP_T, CUBLAS_OP_N, num_in, minibatch, \
+			shard_out, &one, this->_w->getDevData(), shard_out, \
+			dE_dy, num_out, &zero, dE_dx->getDevData(), num_in);
+
+	dE_dx->copyToHost(_h_dE_dx, minibatch * num_in);
+	_comm->allReduce(_h_dE_dx, minibatch * num_in);
+	dE_dx->copyFromHost(_h_dE_dx, minibatch * num_in);
+}
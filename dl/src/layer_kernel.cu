@@ -23,105 +23,65 @@ __global__ void forward_convolution(const float* x, const float* w, \
 		const int in_height, const int in_width, const int in_channel, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, const int filter_channel, \
+		const int pad_height, const int pad_width, \
 		const int stride_height, const int stride_width, \
 		const int box_num_height, const int box_num_width, \
 		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width){
+		const int box_out_height, const int box_out_width, const bool is_relu){
 
+	//输出channel和box放在x维，batch放在y维，避免大图时y维超过65535
 	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
+	const int img_idx = blockIdx.y;
+	const int filt_idx = blockIdx.x / num_box;
+	const int box_idx = blockIdx.x % num_box; 
 	const int box_row_idx = box_idx / box_num_width;
 	const int box_col_idx = box_idx % box_num_width;
 
-	//共享内存里面存放一张图和输入channel个权重
+	//共享内存里面只存放当前channel的一个box和一个权重，大小与输入channel数无关
 	extern __shared__ float sh_w_and_x[];
 
 	int in_pixs = in_height * in_width;
 	int out_pixs = out_height * out_width;
 	int filt_pixs = filter_height * filter_width;
 
-	//输出的行列idx，当输出大于MAX_THREAD_SIZE的时候每个线程都做了计算
-	int out_row = MAX_THREAD_SIZE * box_row_idx + threadIdx.y;
-	int out_col = MAX_THREAD_SIZE * box_col_idx + threadIdx.x;
-
-	int this_box_out_height = (out_height-box_row_idx*MAX_THREAD_SIZE) >= MAX_THREAD_SIZE \
-							  ? box_out_height : (out_height-box_row_idx*MAX_THREAD_SIZE);
-	int this_box_out_width = (out_width-box_col_idx*MAX_THREAD_SIZE) >= MAX_THREAD_SIZE \
-							 ? box_out_width : (out_width-box_col_idx*MAX_THREAD_SIZE);
+	//输出的行列idx，一个线程计算box里的一个输出点
+	int out_row = box_out_height * box_row_idx + threadIdx.y;
+	int out_col = box_out_width * box_col_idx + threadIdx.x;
 
-	int this_box_in_height = (this_box_out_height-1)*stride_height + filter_height;
-	int this_box_in_width = (this_box_out_width-1)*stride_width + filter_width;
+	//box在原图上的起始位置，补零的部分为负数或者超出原图，在载入时直接填0
+	int in_row = box_out_height * box_row_idx * stride_height - pad_height;
+	int	in_col = box_out_width * box_col_idx * stride_width - pad_width;
 
-	int in_row = box_in_height * box_row_idx - (filter_height-stride_height)*box_row_idx;
-	int	in_col = box_in_width * box_col_idx - (filter_width-stride_width)*box_col_idx;
+	const int num_thread = blockDim.x * blockDim.y;
+	const int tid = threadIdx.y * blockDim.x + threadIdx.x;
 
 	w += filt_idx*in_channel*filt_pixs;
+	x += img_idx * in_channel * in_pixs;
 
-	int start = threadIdx.y*blockDim.x+threadIdx.x;
-	while(start < in_channel*filt_pixs){
-		sh_w_and_x[start] = w[start];
-		start += blockDim.y*blockDim.x;
-	}
-	__syncthreads();
-
-	if(out_row < out_height && out_col < out_width){
-		//x定位哪一个batch
-		x += img_idx * in_channel * in_pixs + in_row*in_width + in_col;
-		//定位到哪一个filter
-		bias += filt_idx;
-		//输出定位到输出的某一张图
-		targets += img_idx * filter_channel * out_pixs + filt_idx * out_pixs \
-				   + out_row * out_width + out_col;
-
-		float out_value = 0;
-		float *sh_w = sh_w_and_x;
-		float *sh_x = sh_w_and_x + in_channel*filt_pixs;
-
-		int height_copy_time = this_box_in_height / this_box_out_height;
-		int width_copy_time = this_box_in_width / this_box_out_width;
-
-		int interval_height = this_box_in_height - this_box_out_height*height_copy_time;
-		int interval_width = this_box_in_width - this_box_out_width*width_copy_time;
+	float *sh_w = sh_w_and_x;
+	float *sh_x = sh_w_and_x + filt_pixs;
 
-		for(int k = 0; k < in_channel; k++){
-			const float *x_offset = x + k*in_pixs;
-			const float *w_offset = sh_w + k*filt_pixs;
-
-			//在此处对每一张输入将数据存到共享内存中
-			for(int m=0; m < height_copy_time; m++){
-				for(int n=0; n < width_copy_time; n++){
-					sh_x[(threadIdx.y+m*this_box_out_height)*box_in_width + threadIdx.x+n*this_box_out_width] \
-						= x_offset[(threadIdx.y+m*this_box_out_height)*in_width \
-						+threadIdx.x+n*this_box_out_width];
-				}
-			}
-			if(threadIdx.x < interval_width){
-				for(int m=0; m < height_copy_time; m++){
-					sh_x[(threadIdx.y+m*this_box_out_height)*box_in_width \
-						+threadIdx.x+this_box_out_width*width_copy_time] \
-						= x_offset[(threadIdx.y+m*this_box_out_height)*in_width+threadIdx.x \
-						+this_box_out_width*width_copy_time];
-				}	
-			}
-			if(threadIdx.y < interval_height){
-				for(int n=0; n < width_copy_time; n++){
-					sh_x[(threadIdx.y+this_box_out_height*height_copy_time)*box_in_width \
-						+threadIdx.x+n*this_box_out_width] \
-						= x_offset[(threadIdx.y+this_box_out_height*height_copy_time)*in_width \
-						+threadIdx.x+n*this_box_out_width];
-				}
-			}
-			if(threadIdx.y < interval_height && threadIdx.x < interval_width){
-				sh_x[(threadIdx.y+this_box_out_height*height_copy_time)*box_in_width \
-					+threadIdx.x+this_box_out_width*width_copy_time] \
-					= x_offset[(threadIdx.y+this_box_out_height*height_copy_time)*in_width \
-					+threadIdx.x+this_box_out_width*width_copy_time];
-			}
-			__syncthreads();
+	float out_value = 0;
+	for(int k = 0; k < in_channel; k++){
+		const float *x_offset = x + k*in_pixs;
+		const float *w_offset = sh_w;
 
+		//上一个channel的计算完成后才能覆盖共享内存
+		__syncthreads();
+		for(int i = tid; i < filt_pixs; i += num_thread){
+			sh_w[i] = w[k*filt_pixs + i];
+		}
+		for(int i = tid; i < box_in_height*box_in_width; i += num_thread){
+			int row = in_row + i / box_in_width;
+			int col = in_col + i % box_in_width;
+			if(row >= 0 && row < in_height && col >= 0 && col < in_width)
+				sh_x[i] = x_offset[row*in_width + col];
+			else
+				sh_x[i] = 0;
+		}
+		__syncthreads();
 
+		if(out_row < out_height && out_col < out_width){
 			for(int i = 0; i < filter_height; i++){
 				int box_in_row = threadIdx.y * stride_height + i;
 				const float *x_offset_1 = sh_x + box_in_row*box_in_width;
@@ -129,596 +89,345 @@ __global__ void forward_convolution(const float* x, const float* w, \
 
 				for(int j = 0; j < filter_width; j++){
 					int box_in_col = threadIdx.x * stride_width + j;
-
-					if(box_in_row < box_in_height && box_in_col < box_in_width){
-						out_value += x_offset_1[box_in_col] \
-									 *w_offset_1[j];
-					}
+					out_value += x_offset_1[box_in_col] * w_offset_1[j];
 				}
 			}
 		}
-		__syncthreads();
-		targets[0] = out_value + bias[0];
+	}
+
+	if(out_row < out_height && out_col < out_width){
+		targets += img_idx * filter_channel * out_pixs + filt_idx * out_pixs \
+				   + out_row * out_width + out_col;
+		out_value += bias[filt_idx];
+		targets[0] = is_relu && out_value < 0 ? 0 : out_value;
 	}
 }
 
-__global__ void backward_convolution(const float* dE_dy, const float *w, \
-		float* targets, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int out_channel, const int in_channel, \
+//每个线程写展开矩阵的一个元素，连续的线程对应同一行相邻的输出位置
+__global__ void im2col(const float* x, float* col, const int num_kernel, \
+		const int in_height, const int in_width, const int in_channel, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width, \
-		const int box_num_height, const int box_num_width){
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width){
 
-	extern __shared__ float result[];
-
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int in_channel_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
+	const int out_pixs = out_height * out_width;
+	const int filt_pixs = filter_height * filter_width;
+	const int col_rows = in_channel * filt_pixs;
 
-	///反向求的输入width
-	const int in_height = box_in_height * box_num_height; 
-	const int in_width = box_in_width * box_num_width; 
-	int in_pixs = in_height * in_width;
-	int filt_pixs = filter_height * filter_width;
-	int out_pixs = out_height * out_width;
-
-	//输出的行列idx,当pooling之后的width小于32时，box_row_idx会等于0
-	int out_row = box_out_height * box_row_idx + threadIdx.y;
-	int out_col = box_out_width * box_col_idx + threadIdx.x;
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		const int out_col = idx % out_width;
+		const int out_row = (idx / out_width) % out_height;
+		const int col_row = (idx / out_pixs) % col_rows;
+		const int img_idx = idx / (out_pixs * col_rows);
+
+		const int channel_idx = col_row / filt_pixs;
+		const int in_row = out_row * stride_height - pad_height \
+						   + (col_row % filt_pixs) / filter_width;
+		const int in_col = out_col * stride_width - pad_width \
+						   + col_row % filter_width;
+
+		if(in_row >= 0 && in_row < in_height && in_col >= 0 && in_col < in_width)
+			col[idx] = x[((img_idx * in_channel + channel_idx) * in_height \
+					+ in_row) * in_width + in_col];
+		else
+			col[idx] = 0;
+	}
+}
 
-	if(out_row < out_height && out_col < out_width){
-		targets += img_idx * in_channel * in_pixs + in_channel_idx * in_pixs \
-				   + box_row_idx * box_in_height * in_width \
-				   + box_col_idx * box_in_width;
-		dE_dy += img_idx*out_channel*out_pixs + out_row*out_width + out_col;
-		w += in_channel_idx*filt_pixs;
-
-		int interval_height = box_row_idx != (box_num_height-1) ? box_out_height \
-							  : out_height - box_out_height*(box_num_height-1);
-		int interval_width = box_col_idx != (box_num_width-1) ? box_out_width \
-							 : out_width - box_out_width*(box_num_width-1);
-
-		int tmp_row = threadIdx.y;
-		int tmp_col = threadIdx.x;
-		while(tmp_row < box_in_height){
-			tmp_col = threadIdx.x;
-			while(tmp_col < box_in_width){
-				result[tmp_row*box_in_width + tmp_col] = 0;
-				tmp_col += interval_width;
-			}
-			tmp_row += interval_height;
-		}
+__global__ void add_conv_bias(float* targets, const float* bias, \
+		const int num_kernel, const int out_pixs, const int out_channel, \
+		const bool is_relu){
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		const float value = targets[idx] + bias[(idx / out_pixs) % out_channel];
+		targets[idx] = is_relu && value < 0 ? 0 : value;
+	}
+}
 
-		float ele = 0;
-		for(int k = 0; k < out_channel; k++){
-			const float *dE_dy_offset = dE_dy + k*out_pixs;
-			const float *w_offset = w + k*filt_pixs*in_channel;
+__global__ void relu_mask_back(const float* y, float* dE_dy, const int num_kernel){
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		if(y[idx] <= 0)
+			dE_dy[idx] = 0;
+	}
+}
 
-			for(int i = 0; i < filter_height; i++){
-				int box_in_row = threadIdx.y*stride_height + i;
-				const float *w_offset_1 = w_offset + i*filter_width;
-				float *result_offset = result + box_in_row*box_in_width;
+//每个线程计算一个输入点的导数，遍历所有输出channel中覆盖该点的位置求和，
+//每个位置只由一个线程写入，重叠的部分不需要原子操作，也不需要展开的中间结果
+__global__ void backward_convolution(const float* dE_dy, const float *w, \
+		float* targets, const int num_kernel, \
+		const int in_height, const int in_width, const int in_channel, \
+		const int out_height, const int out_width, const int out_channel, \
+		const int filter_height, const int filter_width, \
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width){
 
-				for(int j = 0; j < filter_width; j++){
-					int box_in_col = threadIdx.x*stride_width + j;
+	const int in_pixs = in_height * in_width;
+	const int out_pixs = out_height * out_width;
+	const int filt_pixs = filter_height * filter_width;
 
-					if(box_in_row < box_in_height \
-							&& box_in_col < box_in_width){
-						ele = dE_dy_offset[0]*w_offset_1[j];
-						atomicAdd(result_offset+box_in_col, ele);
-						__syncthreads();
-					}
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		const int img_idx = idx / (in_channel * in_pixs);
+		const int in_channel_idx = (idx / in_pixs) % in_channel;
+		//补零后的坐标
+		const int in_row = (idx % in_pixs) / in_width + pad_height;
+		const int in_col = (idx % in_pixs) % in_width + pad_width;
+
+		const int out_row_start = in_row < filter_height ? 0 \
+								  : (in_row - filter_height) / stride_height + 1;
+		const int out_row_end = min(in_row / stride_height + 1, out_height);
+		const int out_col_start = in_col < filter_width ? 0 \
+								  : (in_col - filter_width) / stride_width + 1;
+		const int out_col_end = min(in_col / stride_width + 1, out_width);
+
+		float value = 0;
+		for(int k = 0; k < out_channel; k++){
+			const float *dE_dy_offset = dE_dy + (img_idx*out_channel + k)*out_pixs;
+			const float *w_offset = w + (k*in_channel + in_channel_idx)*filt_pixs;
+
+			for(int i = out_row_start; i < out_row_end; i++){
+				const float *w_offset_1 = w_offset \
+										  + (in_row - i*stride_height)*filter_width;
+				for(int j = out_col_start; j < out_col_end; j++){
+					value += dE_dy_offset[i*out_width + j] \
+							 * w_offset_1[in_col - j*stride_width];
 				}
 			}
 		}
-
-		tmp_row = threadIdx.y;
-		while(tmp_row < box_in_height){
-			tmp_col = threadIdx.x;
-			float *target_offset = targets + tmp_row*in_width;
-			float *result_offset = result + tmp_row*box_in_width;
-
-			while(tmp_col < box_in_width){
-				target_offset[tmp_col] = result_offset[tmp_col];
-				tmp_col += interval_width;
-			}
-			tmp_row += interval_height;
-		}
+		targets[idx] = value;
 	}
 }
 
 
+//每个block计算dE_dw中的一个值，对minibatch和输出的所有位置求和，
+//线程先各自累加一部分，再在共享内存中做树形规约，不需要按batch展开的中间结果
 __global__ void compute_convolution_derivs(const float* dE_dy, const float *x, \
-		float* dE_dw, const int box_out_height, const int box_out_width, \
+		float* dE_dw, const int minibatch_size, \
 		const int out_channel, const int in_channel, const int in_height, \
 		const int in_width, const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width, \
-		const int box_num_height, const int box_num_width){
-
-	extern __shared__ float result[];
-
-	int in_pixs = in_height * in_width;
-	int filt_pixs = filter_height * filter_width;
-	int out_pixs = out_height * out_width;
-	int box_out_pixs = box_out_height * box_out_width;
-
-	const int num_box = box_num_height * box_num_width;	
-
-	const int img_idx = blockIdx.x;
+		const int pad_height, const int pad_width, \
+		const int stride_height, const int stride_width){
 
-	int tmp = blockIdx.y;
-	const int box_idx = tmp / filt_pixs;
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
-	const int filt_row_idx = (tmp % filt_pixs) / filter_width; 
-	const int filt_col_idx = (tmp % filt_pixs) % filter_width; 
+	__shared__ float result[REDUCE_BLOCK_SIZE];
 
-	int out_row = box_out_height * box_row_idx + threadIdx.y;
-	int out_col = box_out_width * box_col_idx + threadIdx.x;
-	int in_row = out_row*stride_height + filt_row_idx;
-	int in_col = out_col*stride_width + filt_col_idx;
-
-	int pow2Length = box_out_pixs;
-	if(pow2Length & (pow2Length - 1)){
-		while(pow2Length & (pow2Length - 1)){
-			pow2Length &= pow2Length - 1;
+	const int in_pixs = in_height * in_width;
+	const int filt_pixs = filter_height * filter_width;
+	const int out_pixs = out_height * out_width;
+
+	const int in_channel_idx = blockIdx.x / filt_pixs;
+	const int filt_row_idx = (blockIdx.x % filt_pixs) / filter_width;
+	const int filt_col_idx = (blockIdx.x % filt_pixs) % filter_width;
+	const int out_channel_idx = blockIdx.y;
+
+	float value = 0;
+	for(int i = threadIdx.x; i < minibatch_size*out_pixs; i += blockDim.x){
+		const int img_idx = i / out_pixs;
+		const int out_row = (i % out_pixs) / out_width;
+		const int out_col = (i % out_pixs) % out_width;
+		//补零区域对应的x为0，不读取内存
+		const int in_row = out_row*stride_height + filt_row_idx - pad_height;
+		const int in_col = out_col*stride_width + filt_col_idx - pad_width;
+
+		if(in_row >= 0 && in_row < in_height && in_col >= 0 && in_col < in_width){
+			value += dE_dy[(img_idx*out_channel + out_channel_idx)*out_pixs \
+						+ out_row*out_width + out_col] \
+					* x[(img_idx*in_channel + in_channel_idx)*in_pixs \
+						+ in_row*in_width + in_col];
 		}
 	}
+	result[threadIdx.x] = value;
 	__syncthreads();
 
-	if(threadIdx.y < box_out_height && threadIdx.x < box_out_width)
-		result[threadIdx.y*box_out_width+threadIdx.x] = 0;
-	__syncthreads();
-
-	if(out_row < out_height && out_col < out_width \
-			&& in_row < in_height && in_col < in_width){
-		x += img_idx*in_channel*in_pixs + in_row*in_width + in_col;
-		dE_dw += img_idx*out_channel*in_channel*filt_pixs*num_box + box_idx*filt_pixs \
-				 + filt_row_idx*filter_width + filt_col_idx;
-		dE_dy += img_idx*out_channel*out_pixs + out_row*out_width + out_col;
-	}
-	__syncthreads();
-
-	for(int i = 0; i < out_channel; i++){
-		for(int j = 0; j < in_channel; j++){
-			const float *x_offset, *dE_dy_offset;
-			float *dE_dw_offset;
-			int idx = threadIdx.y*box_out_width + threadIdx.x;
-			if(out_row < out_height && out_col < out_width \
-					&& in_row < in_height && in_col < in_width){
-				x_offset = x + j*in_pixs; 
-				dE_dw_offset = dE_dw + i*in_channel*filt_pixs*num_box \
-							   + j*filt_pixs*num_box;
-				dE_dy_offset = dE_dy + i*out_pixs;
-				result[idx] = dE_dy_offset[0]*x_offset[0];
-			}
-			__syncthreads();
-
-			if(idx >= pow2Length && idx < box_out_pixs)
-				result[idx - pow2Length] += result[idx];
-
-			for(int activeThreads = (pow2Length >> 1); activeThreads; \
-					activeThreads >>= 1){
-				if(idx < activeThreads)
-					result[idx] += result[idx+activeThreads];
-				__syncthreads();
-			}
-
-			if(out_row < out_height && out_col < out_width \
-					&& in_row < in_height && in_col < in_width && idx == 0){
-				dE_dw_offset[0] = result[0];
-			}
-		}
+	for(int active_threads = (blockDim.x >> 1); active_threads; active_threads >>= 1){
+		if(threadIdx.x < active_threads)
+			result[threadIdx.x] += result[threadIdx.x + active_threads];
+		__syncthreads();
 	}
 
+	if(threadIdx.x == 0)
+		dE_dw[(out_channel_idx*in_channel + in_channel_idx)*filt_pixs \
+			+ filt_row_idx*filter_width + filt_col_idx] = result[0];
 }
 
-__global__ void compact_dervis_w(const float* unranged_dE_dw, \
-		float* dE_dw, const int filter_height, const int filter_width, \
-		const int box_num_height, const int box_num_width, \
-		const int minibatch_size, const int in_channel, const int out_channel){
-	//此处grid是一维
-	int filt_idx = blockIdx.y;	
-	const int num_box = box_num_height * box_num_width;	
-	int filt_pixs = filter_height * filter_width;
-	if(threadIdx.y < filter_height && threadIdx.x < filter_width){
-		dE_dw += filt_idx*filt_pixs + threadIdx.y*filter_width + threadIdx.x;
-		unranged_dE_dw += filt_idx*filt_pixs*num_box \
-						  + threadIdx.y*filter_width + threadIdx.x;
-		dE_dw[0] = 0;
-		int value = in_channel*out_channel*filt_pixs*num_box;
-		for(int k = 0; k < minibatch_size; k++){
-			const float *unranged_dE_dw_offset = unranged_dE_dw + k*value;
-			for(int i = 0; i < num_box; i++){
-				dE_dw[0] += unranged_dE_dw_offset[i*filt_pixs]; 
-			}
-
-		}
-	}
-}
-
-__global__ void compute_derivs_of_bias(const float* dE_dy, float* targets, \
-		const int out_height, const int out_width, const int out_channel, \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width){
-
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
-
-	int out_pixs = out_height * out_width;
-	int box_out_pixs = box_out_height * box_out_width;
-
-	extern __shared__ float result[];
-
-	//输出的行列idx，当输出大于MAX_THREAD_SIZE的时候每个线程都做了计算
-	int out_row = box_out_height * box_row_idx + threadIdx.y;
-	int out_col = box_out_width * box_col_idx + threadIdx.x;
-
-	if(threadIdx.y < box_out_height && threadIdx.x < box_out_width)
-		result[threadIdx.y*box_out_width+threadIdx.x] = 0;
-
-	if(out_row < out_height && out_col < out_width){
-		dE_dy += img_idx*out_pixs*out_channel + filt_idx*out_pixs \
-				 + out_row*out_width + out_col;
+//每个block计算一个输出channel的bias导数
+__global__ void compute_derivs_of_bias(const float* dE_dy, float* dE_db, \
+		const int minibatch_size, const int out_pixs, const int out_channel){
 
-		targets += img_idx*out_channel*num_box+filt_idx*num_box \
-				   +box_row_idx*box_num_width + box_col_idx;
+	__shared__ float result[REDUCE_BLOCK_SIZE];
 
-		int idx = threadIdx.y*box_out_width + threadIdx.x;
-		result[idx] = dE_dy[0];
+	const int out_channel_idx = blockIdx.x;
 
-		int pow2Length = box_out_pixs;
-		if(pow2Length & (pow2Length - 1)){
-			while(pow2Length & (pow2Length - 1)){
-				pow2Length &= pow2Length - 1;
-			}
-		}
-		__syncthreads();
+	float value = 0;
+	for(int i = threadIdx.x; i < minibatch_size*out_pixs; i += blockDim.x){
+		const int img_idx = i / out_pixs;
+		value += dE_dy[(img_idx*out_channel + out_channel_idx)*out_pixs \
+					+ i % out_pixs];
+	}
+	result[threadIdx.x] = value;
+	__syncthreads();
 
-		if(idx >= pow2Length && idx < box_out_pixs)
-			result[idx - pow2Length] += result[idx];
+	for(int active_threads = (blockDim.x >> 1); active_threads; active_threads >>= 1){
+		if(threadIdx.x < active_threads)
+			result[threadIdx.x] += result[threadIdx.x + active_threads];
 		__syncthreads();
-
-		for(int activeThreads = (pow2Length >> 1); activeThreads; \
-				activeThreads >>= 1){
-			if(idx < activeThreads)
-				result[idx] += result[idx+activeThreads];
-			__syncthreads();
-		}
-
-		if(idx == 0)
-			targets[0] = result[0];
 	}
-}
-
-
-__global__ void pad_to_ori(float* dst, const float* src, const int num_kernel, \
-		const int img_height, const int img_width, \
-		const int padded_img_height, const int padded_img_width, \
-		const int img_channel){
-
-	int index;
-	int img_pixs = img_height * img_width;
-	int padded_img_pixs = padded_img_height * padded_img_width;
-	int pad_height = (padded_img_height - img_height) / 2;
-	int pad_width = (padded_img_width - img_width) / 2;
-	int one_img_len = img_channel*img_pixs;
-	CUDA_KERNEL_LOOP(idx, num_kernel){
 
-		const int img_idx = idx / one_img_len;
-		const int src_col = idx % one_img_len;
-		const int img_channel_idx = src_col / img_pixs;
-		const int img_row = (src_col % img_pixs) / img_width; 
-		const int img_col = (src_col % img_pixs) % img_width; 
-		index = img_idx * img_channel * padded_img_pixs \
-				+ img_channel_idx * padded_img_pixs \
-				+ (img_row + pad_height) * padded_img_width \
-				+ (img_col + pad_width); 
-		dst[idx] = src[index]; 
-	}
+	if(threadIdx.x == 0)
+		dE_db[out_channel_idx] = result[0];
 }
 
-__global__ void ori_to_padding(const float* src, float* dst, const int num_kernel, \
-		const int img_height, const int img_width, const int padded_img_height, \
-		const int padded_img_width, const int img_channel){
-
-	int index;
-	int img_pixs = img_height * img_width;
-	int padded_img_pixs = padded_img_height * padded_img_width;
-	int pad_height = (padded_img_height - img_height) / 2;
-	int pad_width = (padded_img_width - img_width) / 2;
-	int one_img_len = img_channel*img_pixs;
-	CUDA_KERNEL_LOOP(idx, num_kernel){
-
-		const int img_idx = idx / one_img_len;
-		const int src_col = idx % one_img_len;
-		const int img_channel_idx = src_col / img_pixs;
-		const int img_row = (src_col % img_pixs) / img_width; 
-		const int img_col = (src_col % img_pixs) % img_width; 
-		index = img_idx * img_channel * padded_img_pixs \
-				+ img_channel_idx * padded_img_pixs \
-				+ (img_row + pad_height) * padded_img_width \
-				+ (img_col + pad_width); 
-		dst[index] = src[idx]; 
-	}
-
-}
 
-__global__ void max_pooling(const float* x, float* targets, int* maxPoolPos, \
-		const int in_height, const int in_width, \
-		const int in_channels, const int out_height, const int out_width, \
+//每个线程计算一个输出点，不再按box划分，输出大小不受线程块大小限制
+__global__ void max_pooling(const float* x, float* targets, unsigned char* maxPoolPos, \
+		const int num_kernel, const int in_height, const int in_width, \
+		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width){
+		const int stride_height, const int stride_width){
 
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
+	const int conv_pixs = in_height * in_width;
+	const int pool_pixs = out_height * out_width;
 
-	int conv_pixs = in_height * in_width;
-	int pool_pixs = out_height * out_width;
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		//img_channel_idx是batch和channel合在一起的下标
+		const int img_channel_idx = idx / pool_pixs;
+		const int out_row = (idx % pool_pixs) / out_width;
+		const int out_col = (idx % pool_pixs) % out_width;
 
-	//输出的行列idx，当输出大于MAX_THREAD_SIZE的时候每个线程都做了计算
-	int out_row = MAX_THREAD_SIZE * box_row_idx + threadIdx.y;
-	int out_col = MAX_THREAD_SIZE * box_col_idx + threadIdx.x;
+		const float* x_offset = x + img_channel_idx * conv_pixs;
 
-	if(out_row < out_height && out_col < out_width){
-		//首先定位哪一个batch的哪一个channel的哪一张图，然后寻找在这张图上位置
-		x += img_idx * in_channels * conv_pixs + filt_idx * conv_pixs;
-		targets += img_idx * in_channels * pool_pixs + filt_idx * pool_pixs \
-				   + out_row * out_width + out_col;
-		maxPoolPos += img_idx * in_channels * pool_pixs + filt_idx * pool_pixs \
-					  + out_row * out_width + out_col;
-
-		float max_value = x[out_row*stride_height*in_width+out_col*stride_width];
+		float max_value = x_offset[out_row*stride_height*in_width+out_col*stride_width];
 		int max_pos = 0;
 		for(int i = 0; i < filter_height; i++){
 			int conv_row = out_row * stride_height + i;
-			const float* x_offset = x + conv_row*in_width; 
+			const float* x_offset_1 = x_offset + conv_row*in_width; 
 
 			for(int j = 0; j < filter_width; j++){
 				int conv_col = out_col * stride_width + j;
 
 				if(conv_row < in_height && conv_col < in_width){
-					if(x_offset[conv_col]>max_value){
-						max_value = x_offset[conv_col];
+					if(x_offset_1[conv_col]>max_value){
+						max_value = x_offset_1[conv_col];
 						max_pos = i*filter_width +j;
 					}
 				}
 			}
 		}
-		__syncthreads();
 
-		targets[0] = max_value;
-		maxPoolPos[0] = max_pos;
+		targets[idx] = max_value;
+		maxPoolPos[idx] = max_pos;
 	}
 }
 
 __global__ void avg_pooling(const float* x, float* targets, \
-		const int in_height, const int in_width, \
-		const int in_channels, const int out_height, const int out_width, \
+		const int num_kernel, const int in_height, const int in_width, \
+		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_out_height, const int box_out_width, \
-		const int box_num_height, const int box_num_width){
-
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
+		const int stride_height, const int stride_width){
 
-	int conv_pixs = in_height * in_width;
-	int pool_pixs = out_height * out_width;
+	const int conv_pixs = in_height * in_width;
+	const int pool_pixs = out_height * out_width;
 
-	int out_row = MAX_THREAD_SIZE * box_row_idx + threadIdx.y;
-	int out_col = MAX_THREAD_SIZE * box_col_idx + threadIdx.x;
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		const int img_channel_idx = idx / pool_pixs;
+		const int out_row = (idx % pool_pixs) / out_width;
+		const int out_col = (idx % pool_pixs) % out_width;
 
-	if(out_row < out_height && out_col < out_width){
-		x += img_idx * in_channels * conv_pixs + filt_idx * conv_pixs; 
-		targets += img_idx * in_channels * pool_pixs + filt_idx * pool_pixs \
-				   + out_row * out_width + out_col;
+		const float* x_offset = x + img_channel_idx * conv_pixs;
 
 		float avg_value = 0;
 		for(int i = 0; i < filter_height; i++){
 			int conv_row = out_row * stride_height + i;
-			const float* x_offset = x + conv_row*in_width; 
+			const float* x_offset_1 = x_offset + conv_row*in_width; 
 
 			for(int j = 0; j < filter_width; j++){
 				int conv_col = out_col * stride_width + j;
 				if(conv_row < in_height && conv_col < in_width){
-					avg_value += x_offset[conv_col];
+					avg_value += x_offset_1[conv_col];
 				}
 			}
 		}
-		__syncthreads();
 
-		targets[0] = avg_value / (filter_height * filter_width);
+		targets[idx] = avg_value / (filter_height * filter_width);
 	}
 }
 
 
 
+//每个线程计算一个输入点的导数，遍历覆盖该点的pooling窗口，
+//窗口内记录的最大值位置等于该点时累加，不需要共享内存和原子操作
 __global__ void compute_dE_dy_max(const float* dE_dy_i, float* targets, \
-		int* maxPoolPos, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int num_filters, \
+		const unsigned char* maxPoolPos, const int num_kernel, \
+		const int in_height, const int in_width, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_num_height, const int box_num_width){
-
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
-
-	const int in_height = box_in_height * box_num_height; 
-	const int in_width = box_in_width * box_num_width; 
-	int in_pixs = in_height * in_width;
-	int pool_pixs = out_height * out_width;
-
-	//输出的行列idx
-	int out_row = box_out_height * box_row_idx + threadIdx.y;
-	int out_col = box_out_width * box_col_idx + threadIdx.x;
+		const int stride_height, const int stride_width){
 
-	int in_row = box_in_height * box_row_idx + threadIdx.y * stride_height \
-				 - (filter_height-stride_height)*box_row_idx;
-	int	in_col = box_in_width * box_col_idx + threadIdx.x * stride_width \
-				 - (filter_width-stride_width)*box_col_idx;
-
-	//共享内存的大小只有计算一块pool输出的对应conv输入
-	extern __shared__ float result[];
+	const int in_pixs = in_height * in_width;
+	const int pool_pixs = out_height * out_width;
 
-	if(out_row < out_height && out_col < out_width){
-		targets += img_idx * num_filters * in_pixs + filt_idx * in_pixs \
-				   + in_row * in_width + in_col; 
-		dE_dy_i += img_idx * num_filters * pool_pixs + filt_idx * pool_pixs \
-				   + out_row * out_width + out_col;
-		maxPoolPos += img_idx * num_filters * pool_pixs + filt_idx * pool_pixs \
-					  + out_row * out_width + out_col;
-
-		int posIdx= threadIdx.y * box_in_width * stride_height \
-					+ threadIdx.x * stride_width;
-
-		int interval_height = box_row_idx != (box_num_height-1) ? box_out_height \
-							  : out_height - box_out_height*(box_num_height-1);
-		int interval_width = box_col_idx != (box_num_width-1) ? box_out_width \
-							 : out_width - box_out_width*(box_num_width-1);
-
-		int tmp_row = threadIdx.y;
-		int tmp_col = threadIdx.x;
-		while(tmp_row < box_in_height){
-			tmp_col = threadIdx.x;
-			float* result_offset = result + tmp_row*box_in_width;
-
-			while(tmp_col < box_in_width){
-				result_offset[tmp_col] = 0;
-				tmp_col += interval_width;
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		//img_channel_idx是batch和channel合在一起的下标
+		const int img_channel_idx = idx / in_pixs;
+		const int in_row = (idx % in_pixs) / in_width;
+		const int in_col = (idx % in_pixs) % in_width;
+
+		const int out_row_start = in_row < filter_height ? 0 \
+								  : (in_row - filter_height) / stride_height + 1;
+		const int out_row_end = min(in_row / stride_height + 1, out_height);
+		const int out_col_start = in_col < filter_width ? 0 \
+								  : (in_col - filter_width) / stride_width + 1;
+		const int out_col_end = min(in_col / stride_width + 1, out_width);
+
+		const float* dE_dy_offset = dE_dy_i + img_channel_idx * pool_pixs;
+		const unsigned char* pos_offset = maxPoolPos + img_channel_idx * pool_pixs;
+
+		float value = 0;
+		for(int i = out_row_start; i < out_row_end; i++){
+			for(int j = out_col_start; j < out_col_end; j++){
+				int pos = (in_row - i*stride_height) * filter_width \
+						  + in_col - j*stride_width;
+				if(pos_offset[i*out_width + j] == pos)
+					value += dE_dy_offset[i*out_width + j];
 			}
-			tmp_row += interval_height;
-		}
-
-		int pos = maxPoolPos[0];
-		int row = pos / filter_width;
-		int col = pos % filter_width;
-
-		posIdx += row * box_in_width + col;
-
-		float ele = dE_dy_i[0];
-
-		atomicAdd(result+posIdx, ele);
-		__syncthreads();
-
-		if(in_row + row < in_height && in_col + col < in_width){
-			targets[row * in_height + col] = result[posIdx];
 		}
+		targets[idx] = value;
 	}
 }
 
+//与compute_dE_dy_max相同，每个线程对覆盖该点的pooling窗口求和
 __global__ void compute_dE_dy_avg(const float* dE_dy_i, float* targets, \
-		const int box_in_height, const int box_in_width, \
-		const int box_out_height, const int box_out_width, \
-		const int num_filters, \
+		const int num_kernel, \
+		const int in_height, const int in_width, \
 		const int out_height, const int out_width, \
 		const int filter_height, const int filter_width, \
-		const int stride_height, const int stride_width,  \
-		const int box_num_height, const int box_num_width){
-
-	//这里的out代表的是pooling的输出
-	extern __shared__ float result[];
-
-	const int num_box = box_num_height * box_num_width;	
-	const int img_idx = blockIdx.x;
-	const int filt_idx = blockIdx.y / num_box;
-	const int box_idx = blockIdx.y % num_box; 
-	const int box_row_idx = box_idx / box_num_width;
-	const int box_col_idx = box_idx % box_num_width;
-
-	///反向求的输入width
-	const int in_height = box_in_height * box_num_height; 
-	const int in_width = box_in_width * box_num_width; 
-	int in_pixs = in_height * in_width;
-	int pool_pixs = out_height * out_width;
-
-	//输出的行列idx,当pooling之后的width小于32时，box_row_idx会等于0
-	int out_row = box_out_height * box_row_idx + threadIdx.y;
-	int out_col = box_out_width * box_col_idx + threadIdx.x;
-
-	if(out_row < out_height && out_col < out_width){
-		//计算本块pooling对应的输入conv块起始位置
-		//本线程对应的pooling值
-		targets += img_idx * num_filters * in_pixs + filt_idx * in_pixs \
-				   + box_row_idx * box_in_height * in_width \
-				   + box_col_idx * box_in_width;
-		dE_dy_i += img_idx * num_filters * pool_pixs + filt_idx * pool_pixs \
-				   + out_row * out_width + out_col;
+		const int stride_height, const int stride_width){
 
-		float ele;
-		int interval_height = box_row_idx != (box_num_height-1) ? box_out_height \
-							  : out_height - box_out_height*(box_num_height-1);
-		int interval_width = box_col_idx != (box_num_width-1) ? box_out_width \
-							 : out_width - box_out_width*(box_num_width-1);
-
-		int tmp_row = threadIdx.y;
-		int tmp_col = threadIdx.x;
-		while(tmp_row < box_in_height){
-			tmp_col = threadIdx.x;
-			float* result_offset = result + tmp_row*box_in_width;
-
-			while(tmp_col < box_in_width){
-				result_offset[tmp_col] = 0;
-				tmp_col += interval_width;
-			}
-			tmp_row += interval_height;
-		}
+	const int in_pixs = in_height * in_width;
+	const int pool_pixs = out_height * out_width;
+	const int filt_pixs = filter_height * filter_width;
 
-		int filt_pixs = filter_height*filter_width;
-		for(int i = 0; i < filter_height; i++){
-			int box_in_row = threadIdx.y * stride_height + i;
-			float *result_offset = result + box_in_row*box_in_width;
-			for(int j = 0; j < filter_width; j++){
-				int box_in_col = threadIdx.x * stride_width + j;
-				if(box_in_row < box_in_height && box_in_col < box_in_width){
-					ele = dE_dy_i[0] / filt_pixs;
-					atomicAdd(result_offset+box_in_col, ele);
-					__syncthreads();
-				}
-			}
-		}
-		tmp_row = threadIdx.y;
-		tmp_col = threadIdx.x;
-		while(tmp_row < box_in_height){
-			tmp_col = threadIdx.x;
-			float* result_offset = result + tmp_row*box_in_width;
-			float* target_offset = targets + tmp_row*in_width;
-			while(tmp_col < box_in_width){
-				target_offset[tmp_col] = result_offset[tmp_col];
-				tmp_col += interval_width;
+	CUDA_KERNEL_LOOP(idx, num_kernel){
+		const int img_channel_idx = idx / in_pixs;
+		const int in_row = (idx % in_pixs) / in_width;
+		const int in_col = (idx % in_pixs) % in_width;
+
+		const int out_row_start = in_row < filter_height ? 0 \
+								  : (in_row - filter_height) / stride_height + 1;
+		const int out_row_end = min(in_row / stride_height + 1, out_height);
+		const int out_col_start = in_col < filter_width ? 0 \
+								  : (in_col - filter_width) / stride_width + 1;
+		const int out_col_end = min(in_col / stride_width + 1, out_width);
+
+		const float* dE_dy_offset = dE_dy_i + img_channel_idx * pool_pixs;
+
+		float value = 0;
+		for(int i = out_row_start; i < out_row_end; i++){
+			for(int j = out_col_start; j < out_col_end; j++){
+				value += dE_dy_offset[i*out_width + j];
 			}
-			tmp_row += interval_height;
 		}
+		targets[idx] = value / filt_pixs;
 	}
-
 }
 
 __global__ void compute_dE_dy(const float* y_j, const int* labels, \
@@ -732,52 +441,3 @@ __global__ void compute_dE_dy(const float* y_j, const int* labels, \
 		dE_dy_j[ty] = y_j[ty] - (lab == threadIdx.x);
 	__syncthreads();
 }
-
-
-__global__ void compactOverlap(float* src, float* targets, \
-		const int in_height, const int in_width, const int in_channel, \
-		const int overlap_height, const int overlap_width, \
-		const int box_in_height, const int box_in_width, \
-		const int box_num_height, const int box_num_width){
-
-	const int img_idx = blockIdx.x;
-	const int filt_idx = threadIdx.x;
-
-	const int unfold_in_height = box_in_height * box_num_height; 
-	const int unfold_in_width = box_in_width * box_num_width; 
-	const int in_pixs = in_height * in_width;
-	const int unfold_in_pix = unfold_in_height*unfold_in_width;
-
-	src += img_idx*in_channel*unfold_in_pix + filt_idx*unfold_in_pix;
-	targets += img_idx*in_channel*in_pixs + filt_idx*in_pixs;
-
-	for(int i = 0; i < unfold_in_height; i++){
-		int in_row = i - overlap_height*(i/box_in_height);
-		float *target_offset = targets + in_row*in_width;
-		float *src_offset = src + i*unfold_in_width;
-
-		for(int j = 0; j < unfold_in_width; j++){
-			int in_col = j - overlap_width*(j/box_in_width);
-			if(in_row >= in_height || in_col >= in_width)
-				break;
-			target_offset[in_col] += src_offset[j];
-		}
-	}
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -7,6 +7,7 @@
 #include <bits/stl_bvector.h>
 #include <algorithm>
 #include "load_layer.hpp"
+#include "engine.hpp"
 
 using namespace std;
 
@@ -43,22 +44,27 @@ LoadLayer<Dtype>::LoadLayer(const int num_train, const int num_valid, \
 	: _num_train(num_train), _num_test(num_test), _num_valid(num_valid), \
 	_img_size(img_size), _img_channel(img_channel){
 		_img_sqrt = _img_size * _img_size;
+		///> 整个数据集放在本进程所在numa节点上，读minibatch时不跨socket
+		Engine *engine = Engine::getInstance();
 		if (img_size > 0 && img_channel > 0) {
 			if (num_train > 0) {
-				_train_pixel = new Dtype[_num_train * _img_sqrt * _img_channel];
-				_train_label = new int[_num_train];
+				_train_pixel = static_cast<Dtype*>(engine->allocHost(sizeof(Dtype) \
+							* _num_train * _img_sqrt * _img_channel));
+				_train_label = static_cast<int*>(engine->allocHost(sizeof(int) * _num_train));
 				_train_pixel_ptr = _train_pixel;
 				_train_label_ptr = _train_label;
 			}
 			if (num_valid > 0) {
-				_valid_pixel = new Dtype[_num_valid * _img_sqrt * _img_channel];
-				_valid_label = new int[_num_valid];
+				_valid_pixel = static_cast<Dtype*>(engine->allocHost(sizeof(Dtype) \
+							* _num_valid * _img_sqrt * _img_channel));
+				_valid_label = static_cast<int*>(engine->allocHost(sizeof(int) * _num_valid));
 				_valid_pixel_ptr = _valid_pixel;
 				_valid_label_ptr = _valid_label;
 			}
 			if (num_test > 0) {
-				_test_pixel = new Dtype[_num_test * _img_sqrt * _img_channel];
-				_test_label = new int[_num_test];
+				_test_pixel = static_cast<Dtype*>(engine->allocHost(sizeof(Dtype) \
+							* _num_test * _img_sqrt * _img_channel));
+				_test_label = static_cast<int*>(engine->allocHost(sizeof(int) * _num_test));
 				_test_pixel_ptr = _test_pixel;
 				_test_label_ptr = _test_label;
 			}
@@ -69,18 +75,19 @@ LoadLayer<Dtype>::LoadLayer(const int num_train, const int num_valid, \
 
 template <typename Dtype>
 LoadLayer<Dtype>::~LoadLayer(){
+	Engine *engine = Engine::getInstance();
 	if (_img_size > 0 && _img_channel > 0 && _is_base_alloc == true) {
 		if (_num_train > 0) {
-			delete[] _train_pixel;
-			delete[] _train_label;
+			engine->freeHost(_train_pixel);
+			engine->freeHost(_train_label);
 		}
 		if (_num_valid > 0) {
-			delete[] _valid_pixel;
-			delete[] _valid_label;
+			engine->freeHost(_valid_pixel);
+			engine->freeHost(_valid_label);
 		}
 		if (_num_test > 0) {
-			delete[] _test_pixel;
-			delete[] _test_label;
+			engine->freeHost(_test_pixel);
+			engine->freeHost(_test_label);
 		}
 	}
 }
@@ -122,6 +129,35 @@ void LoadCifar10<Dtype>::loadValidOneBatch(int batch_idx, \
 	mini_label = this->_valid_label + batch_idx*_minibatch_size;
 }
 
+template <typename Dtype>
+struct ParseCifarArg {
+	LoadLayer<Dtype>* layer;
+	const unsigned char* bytes;
+	Dtype* pixel;
+	int* label;
+	int img_sqrt;
+	int img_channel;
+};
+
+/// 第begin到end-1张图片，每张是1字节类别加上每个通道img_sqrt个像素
+template <typename Dtype>
+static void parseCifarRange(void* arg, const int begin, const int end){
+	ParseCifarArg<Dtype>* pa = static_cast<ParseCifarArg<Dtype>*>(arg);
+	const int img_len = pa->img_sqrt * pa->img_channel;
+	for(int i = begin; i < end; i++){
+		const unsigned char* src = pa->bytes + (long long)i * (img_len + 1);
+		pa->label[i] = (int)src[0];
+		for(int j = 0; j < pa->img_channel; j++){
+			Dtype* dst = pa->pixel + (long long)i * img_len + j * pa->img_sqrt;
+			for(int k = 0; k < pa->img_sqrt; k++)
+				dst[k] = (int)src[1 + j * pa->img_sqrt + k];
+			pa->layer->meanOneImg(dst, pa->img_sqrt);
+//			pa->layer->stdOneImg(dst, pa->img_sqrt);
+		}
+	}
+}
+
+/// 整个文件一次读进来，再交给engine的线程池按图片并行转换和归一化
 template <typename Dtype>
 void LoadCifar10<Dtype>::loadBinary(string filename, \
 		Dtype* &pixel_ptr, int* &label_ptr){
@@ -131,35 +167,27 @@ void LoadCifar10<Dtype>::loadBinary(string filename, \
 		cout << "open file failed\n";
 		exit(EXIT_FAILURE);
 	}
-	unsigned char tmp;
-	char buf;
 	fin.seekg(0, fin.end);
 	int length = fin.tellg();
 	int num = length / (this->_img_sqrt * this->_img_channel + 1);
 	//numebr of picture in this input file. 
 	fin.seekg(0, fin.beg);
-
-	for(int i = 0; i < num; i++){
-		fin.read(&buf, 1);
-		tmp = buf;
-		label_ptr[0] = (int)tmp;
-		for(int j = 0; j < this->_img_channel; j++){
-			for(int k = 0; k < this->_img_sqrt; k++){
-				fin.read(&buf, 1);
-				tmp = buf;
-				pixel_ptr[k] = (int)tmp;
-			}
-			this->meanOneImg(pixel_ptr, this->_img_sqrt);
-//			this->stdOneImg(pixel_ptr, this->_img_sqrt);
-			if(i != num - 1 || j != this->_img_channel - 1)
-				pixel_ptr += this->_img_sqrt;
-
-		}
-		if(i != num - 1){
-			label_ptr++;
-		}
+	if(num == 0){
+		fin.close();
+		return;
 	}
+
+	vector<unsigned char> bytes(length);
+	fin.read((char*)&bytes[0], length);
 	fin.close();
+
+	ParseCifarArg<Dtype> arg = {this, &bytes[0], pixel_ptr, label_ptr, \
+		this->_img_sqrt, this->_img_channel};
+	Engine::getInstance()->parallelFor(0, num, 256, parseCifarRange<Dtype>, &arg);
+
+	///> 和逐张读取时一样，指针停在最后一张图片的最后一个通道和最后一个类别
+	pixel_ptr += ((long long)num * this->_img_channel - 1) * this->_img_sqrt;
+	label_ptr += num - 1;
 }
 
 
@@ -89,7 +89,7 @@ void Logistic<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx, Matrix<int>* la
 	const int num_thread = DIVUP(this->_fcp->getNumOut(), ADD_BLOCK_SIZE) * ADD_BLOCK_SIZE;
 	compute_dE_dy<<<this->_fcp->getMinibatchSize(), num_thread>>>(this->_y->getDevData(), \
 			labels->getDevData(), dE_dx->getDevData(), this->_fcp->getNumOut());
-	cudaThreadSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 
 }
@@ -30,6 +30,15 @@ Matrix<Dtype>::Matrix(const Matrix<Dtype>* like) {
 	_init(like->getNumRows(), like->getNumCols());
 }
 
+template <typename Dtype>
+Matrix<Dtype>::Matrix(Dtype* data, int num_row, int num_col) {
+	this->_shape.push_back(num_row);
+	this->_shape.push_back(num_col);
+	this->_amount = num_row * num_col;
+	this->_is_own_data = false;
+	this->_data_value = data;
+}
+
 template <typename Dtype>
 Matrix<Dtype>::~Matrix(){
 	if(this->_is_own_data && this->_amount > 0){
@@ -74,13 +83,13 @@ void Matrix<Dtype>::getTranspose(Matrix<Dtype>* target){
 	
 	kTranspose<Dtype><<<grid_size, block_size>>>(this->_data_value, \
 				target->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
 template <typename Dtype>
 void Matrix<Dtype>::rightMult(Matrix<Dtype>* b, float scale_AB, \
-		Matrix<Dtype> *target, cublasHandle_t& handle) {
+		Matrix<Dtype> *target, cublasHandle_t handle) {
 
 	clock_t t = clock();
 
@@ -132,7 +141,7 @@ void Matrix<Dtype>::addRowVector(Matrix<Dtype>* vec, float scaleVec, Matrix<Dtyp
 
 	kAddRowVector<Dtype><<<grid_size, block_size>>>(this->_data_value, vec->getDevData(), \
 			target->getDevData(), width, height, scaleVec);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 	
 }
@@ -151,7 +160,7 @@ void Matrix<Dtype>::subtractFromScalar(float scalar, Matrix<Dtype>* target) {
 	
 	kSubtractFromScalar<Dtype><<<grid_size, block_size>>>(this->_data_value, scalar, \
 			target->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -188,7 +197,7 @@ void Matrix<Dtype>::apply(Matrix<Dtype>::FUNCTIONS f, Matrix<Dtype> *target){
 		kSigmoid<Dtype><<<grid_size, block_size>>>(this->_data_value, target->getDevData(), \
 				width, height);
 	}
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -208,35 +217,22 @@ void Matrix<Dtype>::applyRelu(Matrix<Dtype> *target, Matrix<int>* record, \
 	else
 		kReluBack<Dtype><<<num_blocks, 1024>>>(this->_data_value, \
 				target->getDevData(), record->getDevData(), length);	
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
 template <typename Dtype>
 void Matrix<Dtype>::applyDropout(Matrix<Dtype> *target, Matrix<int>* record, \
-		Matrix<curandState>* rand_probs, bool is_set_up){
-
-	const int width = this->_shape[1];
-	const int height = this->_shape[0];
-	const int num_blocks_x = DIVUP(width, ADD_BLOCK_SIZE);
-	assert(num_blocks_x < NUM_BLOCKS_MAX);
-	const int num_blocks_y = max(1, min(DIVUP(height, ADD_BLOCK_SIZE), \
-				NUM_BLOCKS_MAX));
-	dim3 grid_size(num_blocks_x, num_blocks_y, 1); 
-	dim3 block_size(ADD_BLOCK_SIZE, ADD_BLOCK_SIZE, 1);
+		const unsigned long long seed, const unsigned long long step){
 
-	if(is_set_up == false){
-		kSetUpCurand<Dtype><<<grid_size, block_size>>>(rand_probs->getDevData(), \
-				width, height);	
-		cudaDeviceSynchronize();
-		cudaCheckError();
-	
-	}
+	const int length = this->_shape[0] * this->_shape[1];
+	const int num_blocks = DIVUP(DIVUP(length, 4), 1024);
+	assert(num_blocks < NUM_BLOCKS_MAX);
 
-	kDropout<Dtype><<<grid_size, block_size>>>(this->_data_value, \
+	kDropout<Dtype><<<num_blocks, 1024>>>(this->_data_value, \
 			target->getDevData(), record->getDevData(), \
-			rand_probs->getDevData(), width, height);	
-	cudaDeviceSynchronize();
+			seed, step, length);	
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -252,7 +248,7 @@ void Matrix<Dtype>::sumCol(Matrix<Dtype>* target){
 
 	kDumbSumCols<Dtype><<<height, 1024, sizeof(Dtype) * width>>>(this->_data_value, \
 			target->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -277,7 +273,7 @@ void Matrix<Dtype>::maxPosInRow(Matrix<Dtype>* maxVec){
 	kDumbMaxPosInRow<Dtype><<<grid_size, block_size, \
 			sizeof(Dtype) * width>>>(this->_data_value, \
 			maxVec->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -297,7 +293,7 @@ void Matrix<Dtype>::eltWiseMult(Matrix<Dtype>* b, Matrix<Dtype>* target) {
 
 	kMult<Dtype><<<grid_size, block_size>>>(this->_data_value, \
 			b->getDevData(), target->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -327,7 +323,7 @@ void Matrix<Dtype>::add(Matrix<Dtype>* b, float scale_this, float scale_B){
 	
 	kAdd<Dtype><<<grid_size, block_size>>>(this->getDevData(), b->getDevData(), \
 			this->getDevData(), scale_this, scale_B, width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -380,13 +376,15 @@ template <typename Dtype>
 Dtype Matrix<Dtype>::computeNorm(int len){
 	Dtype norm_cpu;
 	Matrix<Dtype>* norm_gpu = new Matrix<Dtype>(1, 1);
-	kComputeNorm<<<1, 1024, sizeof(Dtype)*len>>>(this->_data_value, \
+	norm_gpu->zeros();
+	const int num_block = min(DIVUP(len, 1024), NUM_BLOCKS_MAX);
+	kComputeNorm<<<num_block, 1024, sizeof(Dtype)*1024>>>(this->_data_value, \
 			norm_gpu->getDevData(), len);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 	norm_gpu->copyToHost(&norm_cpu, 1);
 	delete norm_gpu;
-	return norm_cpu;
+	return sqrt(norm_cpu);
 }
 
 template <typename Dtype>
@@ -394,7 +392,7 @@ void Matrix<Dtype>::cropMatToNew(Matrix<Dtype> *tar, const int row_start, \
 		const int cropped_height, const int col_start, const int cropped_width){
 	kCropImg<<<1, 1024>>>(this->_data_value, tar->getDevData(), row_start, \
 			cropped_height, col_start, cropped_width, this->_shape[1]);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -424,7 +422,7 @@ void Matrix<Dtype>::subedByUnitMat(){
 
 	kSubedByUnitMat<Dtype><<<grid_size, block_size>>>(this->getDevData(), \
 			this->getDevData(), width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
@@ -452,7 +450,7 @@ void Matrix<Dtype>::subPortion(Matrix<Dtype>* b, const int b_row, \
 	kSubPortion<Dtype><<<grid_size, block_size>>>(this->getDevData(), \
 			b->getDevData()+b_col, this->getDevData(), this->_shape[1], \
 			this->_shape[0], width, height);
-	cudaDeviceSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 }
 
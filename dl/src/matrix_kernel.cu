@@ -99,36 +99,30 @@ __global__ void kSoftmax(Dtype* gData, Dtype* target, const int width, \
 
 }
 
-template <typename Dtype>
-__global__ void kSetUpCurand(curandState *state, const int width, const int height) {
-	const int idxY = blockIdx.y * blockDim.y + threadIdx.y;
-	const int idxX = blockIdx.x * blockDim.x + threadIdx.x;
-	const int idx = idxY * width + idxX;
-
-	if(idxY < height && idxX < width){
-		curand_init(0, idx, 0, &state[idx]);
-	}
-}
-
+//Philox是基于计数器的随机数，由(seed, 元素组下标, step)直接算出，不需要保存状态
+//每个线程一次生成4个随机数，处理连续的4个元素
 template <typename Dtype>
 __global__ void kDropout(Dtype* gData, Dtype* target, int* record, \
-		curandState *state, const int width, const int height) {
-	const int idxY = blockIdx.y * blockDim.y + threadIdx.y;
-	const int idxX = blockIdx.x * blockDim.x + threadIdx.x;
-	const int idx = idxY * width + idxX;
+		const unsigned long long seed, const unsigned long long step, \
+		const int length) {
+	const int vec_idx = blockIdx.x * blockDim.x + threadIdx.x;
+	const int idx = vec_idx * 4;
 
-	if(idxY < height && idxX < width){
-		curandState local_state = state[idx];
-		Dtype local_prob = curand_uniform(&local_state);
-		
-		if(local_prob > 0.5){
-			target[idx] = gData[idx];
-			record[idx] = 1;
-		}else{
-			target[idx] = 0;
-			record[idx] = 0;
+	if(idx < length){
+		curandStatePhilox4_32_10_t local_state;
+		curand_init(seed, vec_idx, step * 4, &local_state);
+		float4 local_prob = curand_uniform4(&local_state);
+		float probs[4] = {local_prob.x, local_prob.y, local_prob.z, local_prob.w};
+
+		for(int i = 0; i < 4 && idx + i < length; i++){
+			if(probs[i] > 0.5){
+				target[idx + i] = gData[idx + i];
+				record[idx + i] = 1;
+			}else{
+				target[idx + i] = 0;
+				record[idx + i] = 0;
+			}
 		}
-		state[idx] = local_state;
 	}
 }
 
@@ -370,50 +364,26 @@ __global__ void kTranspose(Dtype* srcData, Dtype* dstData, \
 
 template <typename Dtype>
 __global__ void kComputeNorm(const Dtype* vec, Dtype* norm, const int len){
-	//每一个block计算一个模
+	//每个block把自己那部分的平方和归约以后加到norm上，norm需要先置0，
+	//返回的是平方和，开方在主机上做
 	extern __shared__ Dtype sh_norm[];
 
-	int pow2_len = len;
-	if (pow2_len & (pow2_len - 1)) {
-		while (pow2_len & (pow2_len - 1)){
-			pow2_len &= pow2_len - 1;
-		}
-	}
-
-	int i = threadIdx.x;
-	while (i < len) {
-		sh_norm[i] = vec[i]*vec[i];
-		i += blockDim.x;
-	}
-
-	int reduce_len = pow2_len > blockDim.x ? blockDim.x : pow2_len;
-	int times = len / reduce_len;
-
-	int vec_pos = threadIdx.x + reduce_len * times;
-	if (vec_pos > (reduce_len * times) && vec_pos < len) {
-		sh_norm[vec_pos - reduce_len] += sh_norm[vec_pos];
+	Dtype value = 0;
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < len; \
+			i += blockDim.x * gridDim.x) {
+		value += vec[i]*vec[i];
 	}
+	sh_norm[threadIdx.x] = value;
 	__syncthreads();
 
-	for (int j = times-1; j >= 0; j--) {
-		vec_pos = threadIdx.x + j*reduce_len;
-		if (threadIdx.x == 0 && (j + 1) * reduce_len < len) {
-			sh_norm[0] += sh_norm[(j + 1) * reduce_len];
-		}
+	for (int active_thread = (blockDim.x >> 1); active_thread; active_thread >>= 1) {
+		if (threadIdx.x < active_thread)
+			sh_norm[threadIdx.x] += sh_norm[threadIdx.x + active_thread];
 		__syncthreads();
-		for (int active_thread = (reduce_len >> 1); active_thread; active_thread >>= 1) {
-			if (threadIdx.x < active_thread) {
-				sh_norm[vec_pos] += sh_norm[vec_pos + active_thread];
-			}
-			__syncthreads();
-		}
-	}
-
-	if (threadIdx.x == 0) {
-		norm[0] = sqrt(sh_norm[0]);
 	}
 
-	__syncthreads();
+	if (threadIdx.x == 0)
+		atomicAdd(norm, sh_norm[0]);
 }
 
 template <typename Dtype>
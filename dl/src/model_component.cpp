@@ -14,12 +14,37 @@ ModelComponent<Dtype>::ModelComponent() {
 	_string_map_layertype["INNERPRODUCT"] = INNERPRODUCT;
 	_string_map_layertype["SOFTMAX"] = SOFTMAX;
 	_string_map_layertype["DROPOUT"] = DROPOUT;
+	_string_map_layertype["ELTWISE_SUM"] = ELTWISE_SUM;
+	_string_map_layertype["CONCAT"] = CONCAT;
 
 	_string_map_pooltype["MAX_POOLING"] = MAX_POOLING;
 	_string_map_pooltype["AVG_POOLING"] = AVG_POOLING;
 
+	_string_map_optimizertype["SGD"] = SGD;
+	_string_map_optimizertype["NESTEROV"] = NESTEROV;
+	_string_map_optimizertype["ADAM"] = ADAM;
+	_string_map_optimizertype["ADAMW"] = ADAMW;
+	_string_map_optimizertype["RMSPROP"] = RMSPROP;
+	_string_map_optimizertype["LARS"] = LARS;
+	_string_map_optimizertype["LAMB"] = LAMB;
+
+	_string_map_pipelineschedule["GPIPE"] = GPIPE;
+	_string_map_pipelineschedule["1F1B"] = ONE_F_ONE_B;
+
+	_string_map_convalgo["AUTO"] = CONV_AUTO;
+	_string_map_convalgo["DIRECT"] = CONV_DIRECT;
+	_string_map_convalgo["IM2COL"] = CONV_IM2COL;
+
 
 	_num_need_train_layers = 0;
+	_num_worker = 1;
+	_is_hogwild = false;
+	_pars_version = NULL;
+	_num_stage = 1;
+	_pipeline_schedule = ONE_F_ONE_B;
+	_is_tensor_parallel = false;
+	_is_autotune = false;
+	_is_fuse = false;
 }
 
 
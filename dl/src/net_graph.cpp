@@ -0,0 +1,95 @@
+///
+/// \file net_graph.cpp
+/// @brief
+
+#include <stdlib.h>
+#include <iostream>
+#include <set>
+#include <algorithm>
+#include "net_graph.hpp"
+
+using namespace std;
+
+int NetGraph::addNode(const string& name, const string& top, \
+		const vector<string>& bottoms){
+	Node node;
+	node.name = name;
+	node.top = top.empty() ? name : top;
+	node.bottoms = bottoms;
+	if (node.bottoms.size() == 0)
+		node.bottoms.push_back(_nodes.size() == 0 ? DATA_TENSOR : _nodes.back().top);
+	///> 导数累加时每层对一个tensor只有一个临时矩阵
+	for (int b = 1; b < node.bottoms.size(); ++b) {
+		if (find(node.bottoms.begin(), node.bottoms.begin() + b, node.bottoms[b]) \
+				!= node.bottoms.begin() + b) {
+			cerr << "layer " << name << " uses " << node.bottoms[b] << " twice." << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	node.shape_param = NULL;
+	_nodes.push_back(node);
+	return _nodes.size() - 1;
+}
+
+/// Kahn算法，入度为0的节点放进按编号排序的集合，每次取编号最小的
+void NetGraph::schedule(){
+	const int num_node = _nodes.size();
+	map<string, int> producer_of;
+	for (int i = 0; i < num_node; ++i) {
+		if (_nodes[i].top == DATA_TENSOR || producer_of.count(_nodes[i].top) > 0) {
+			cerr << "tensor " << _nodes[i].top << " is produced twice." << endl;
+			exit(EXIT_FAILURE);
+		}
+		producer_of[_nodes[i].top] = i;
+	}
+
+	vector<int> num_pending(num_node, 0);
+	for (int i = 0; i < num_node; ++i) {
+		Node& node = _nodes[i];
+		node.producers.clear();
+		for (int b = 0; b < node.bottoms.size(); ++b) {
+			if (node.bottoms[b] == DATA_TENSOR) {
+				node.producers.push_back(-1);
+				continue;
+			}
+			map<string, int>::iterator it = producer_of.find(node.bottoms[b]);
+			if (it == producer_of.end()) {
+				cerr << "bottom " << node.bottoms[b] << " of layer " << node.name \
+					<< " does not exist." << endl;
+				exit(EXIT_FAILURE);
+			}
+			node.producers.push_back(it->second);
+			_nodes[it->second].consumers.push_back(i);
+			num_pending[i]++;
+		}
+	}
+
+	set<int> ready;
+	for (int i = 0; i < num_node; ++i)
+		if (num_pending[i] == 0)
+			ready.insert(i);
+	_order.clear();
+	_pos.assign(num_node, -1);
+	while (!ready.empty()) {
+		const int i = *ready.begin();
+		ready.erase(ready.begin());
+		_pos[i] = _order.size();
+		_order.push_back(i);
+		for (int c = 0; c < _nodes[i].consumers.size(); ++c)
+			if (--num_pending[_nodes[i].consumers[c]] == 0)
+				ready.insert(_nodes[i].consumers[c]);
+	}
+	if (_order.size() != num_node) {
+		cerr << "the layers form a cycle." << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	///> 最后一层计算cost，其他层的输出都必须被使用
+	for (int p = 0; p + 1 < num_node; ++p) {
+		if (_nodes[_order[p]].consumers.size() == 0) {
+			cerr << "output of layer " << _nodes[_order[p]].name \
+				<< " is not used." << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+}
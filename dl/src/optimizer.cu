@@ -0,0 +1,183 @@
+///
+/// \file optimizer.cu
+/// @brief
+
+#include "optimizer.hpp"
+
+using namespace std;
+
+Optimizer::Optimizer(){
+	_is_bf16_state = false;
+	_seed = 1234;
+	_d_states[0] = NULL;
+	_d_states[1] = NULL;
+	_d_norms = NULL;
+	_norms_capacity = 0;
+}
+
+Optimizer::~Optimizer(){
+	cudaFree(_d_states[0]);
+	cudaFree(_d_states[1]);
+	cudaFree(_d_norms);
+}
+
+void Optimizer::createState(const int len){
+	const size_t bytes = (_is_bf16_state ? sizeof(bf16) : sizeof(float)) * len;
+	for (int k = 0; k < getNumState(); ++k) {
+		cudaFree(_d_states[k]);
+		cudaMalloc(&_d_states[k], bytes);
+		cudaMemset(_d_states[k], 0, bytes);
+	}
+}
+
+float* Optimizer::resetNorms(const int num_seg){
+	if (num_seg * 2 > _norms_capacity) {
+		cudaFree(_d_norms);
+		_norms_capacity = num_seg * 2;
+		cudaMalloc((void**)&_d_norms, sizeof(float) * _norms_capacity);
+	}
+	cudaMemsetAsync(_d_norms, 0, sizeof(float) * num_seg * 2, cudaStreamPerThread);
+	return _d_norms;
+}
+
+void Optimizer::printStateType(){
+	cout << "\nstate_type: " << (_is_bf16_state ? "BF16" : "FLOAT");
+}
+
+void SgdOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len));
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len));
+}
+
+template <typename State>
+void SgdOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks){
+	sgd_momentum_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), derivs, segments, _seed);
+}
+
+void SgdOptimizer::printParam(){
+	cout << "\noptimizer: SGD";
+	printStateType();
+}
+
+void NesterovOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len));
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len));
+}
+
+template <typename State>
+void NesterovOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks){
+	nesterov_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), derivs, segments, _seed);
+}
+
+void NesterovOptimizer::printParam(){
+	cout << "\noptimizer: NESTEROV";
+	printStateType();
+}
+
+void AdamOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len));
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len));
+}
+
+template <typename State>
+void AdamOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks){
+	adam_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), getState<State>(1), derivs, segments, \
+			_beta1, _beta2, _eps, _is_decoupled, _seed);
+}
+
+void AdamOptimizer::printParam(){
+	cout << "\noptimizer: " << (_is_decoupled ? "ADAMW" : "ADAM") \
+			<< "\nbeta1: " << _beta1 \
+			<< "\nbeta2: " << _beta2 \
+			<< "\neps: " << _eps;
+	printStateType();
+}
+
+void RMSPropOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len));
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len));
+}
+
+template <typename State>
+void RMSPropOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks){
+	rmsprop_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), derivs, segments, _rho, _eps, _seed);
+}
+
+void RMSPropOptimizer::printParam(){
+	cout << "\noptimizer: RMSPROP" \
+			<< "\nrho: " << _rho \
+			<< "\neps: " << _eps;
+	printStateType();
+}
+
+void LarsOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	float *norms = resetNorms(num_seg);
+	segment_sq_norms<<<getBlocks(num_seg, max_len), UPDATE_BLOCK_SIZE>>>( \
+			pars, derivs, segments, norms);
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len), norms);
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len), norms);
+}
+
+template <typename State>
+void LarsOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks, float* norms){
+	lars_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), derivs, segments, norms, _eta, _seed);
+}
+
+void LarsOptimizer::printParam(){
+	cout << "\noptimizer: LARS" \
+			<< "\neta: " << _eta;
+	printStateType();
+}
+
+void LambOptimizer::update(float* pars, const float* derivs, \
+		const ParsSegment* segments, const int num_seg, const int max_len){
+	float *norms = resetNorms(num_seg);
+	if (_is_bf16_state)
+		launch<bf16>(pars, derivs, segments, getBlocks(num_seg, max_len), norms);
+	else
+		launch<float>(pars, derivs, segments, getBlocks(num_seg, max_len), norms);
+}
+
+template <typename State>
+void LambOptimizer::launch(float* pars, const float* derivs, \
+		const ParsSegment* segments, const dim3 blocks, float* norms){
+	lamb_moments<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), getState<State>(1), derivs, segments, \
+			_beta1, _beta2, _eps, norms, _seed);
+	lamb_update<State><<<blocks, UPDATE_BLOCK_SIZE>>>(pars, \
+			getState<State>(0), getState<State>(1), segments, \
+			_beta1, _beta2, _eps, norms);
+}
+
+void LambOptimizer::printParam(){
+	cout << "\noptimizer: LAMB" \
+			<< "\nbeta1: " << _beta1 \
+			<< "\nbeta2: " << _beta2 \
+			<< "\neps: " << _eps;
+	printStateType();
+}
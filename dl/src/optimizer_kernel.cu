@@ -0,0 +1,436 @@
+/*
+ * filename: optimizer_kernel.cu
+ */
+
+#include <cuda_runtime.h>
+#include <curand_kernel.h>
+#include "optimizer_kernel.cuh"
+
+typedef curandStatePhilox4_32_10_t RoundState;
+
+//block内求和，结果只在0号线程上有效，block大小为UPDATE_BLOCK_SIZE
+__device__ float block_sum(float value, float* result){
+	result[threadIdx.x] = value;
+	__syncthreads();
+
+	for(int active_threads = (blockDim.x >> 1); active_threads; active_threads >>= 1){
+		if(threadIdx.x < active_threads)
+			result[threadIdx.x] += result[threadIdx.x + active_threads];
+		__syncthreads();
+	}
+	return result[0];
+}
+
+//adam的更新方向，偏差修正合并到scale和eps_hat里
+__device__ inline float adam_direction(const float m, const float v, \
+		const float scale, const float eps_hat){
+	return scale * m / (sqrtf(v) + eps_hat);
+}
+
+//float的状态不需要随机数
+__device__ inline void init_rounding(const float* state, RoundState* rng, \
+		const unsigned long long seed, const int step){
+}
+
+//每个线程一个philox子序列，每一步换一个种子，同一个种子和step结果可以复现
+__device__ inline void init_rounding(const bf16* state, RoundState* rng, \
+		const unsigned long long seed, const int step){
+	const int idx = (blockIdx.y * gridDim.x + blockIdx.x) * blockDim.x + threadIdx.x;
+	curand_init(seed ^ (0x9E3779B97F4A7C15ULL * step), idx, 0, rng);
+}
+
+__device__ inline float4 load_state(const float* state, const int i){
+	return reinterpret_cast<const float4*>(state)[i];
+}
+
+__device__ inline float4 load_state(const bf16* state, const int i){
+	const ushort4 u = reinterpret_cast<const ushort4*>(state)[i];
+	return make_float4(__uint_as_float((unsigned int)u.x << 16), \
+			__uint_as_float((unsigned int)u.y << 16), \
+			__uint_as_float((unsigned int)u.z << 16), \
+			__uint_as_float((unsigned int)u.w << 16));
+}
+
+__device__ inline void store_state(float* state, const int i, const float4 value, \
+		RoundState* rng){
+	reinterpret_cast<float4*>(state)[i] = value;
+}
+
+//低16位加上一个均匀的随机数再截断，进位的概率等于被截掉部分的比例
+__device__ inline unsigned short round_to_bf16(const float value, \
+		const unsigned int r){
+	return (__float_as_uint(value) + (r & 0xffff)) >> 16;
+}
+
+__device__ inline void store_state(bf16* state, const int i, const float4 value, \
+		RoundState* rng){
+	const uint4 r = curand4(rng);
+	ushort4 u;
+	u.x = round_to_bf16(value.x, r.x);
+	u.y = round_to_bf16(value.y, r.y);
+	u.z = round_to_bf16(value.z, r.z);
+	u.w = round_to_bf16(value.w, r.w);
+	reinterpret_cast<ushort4*>(state)[i] = u;
+}
+
+template <typename State>
+__global__ void sgd_momentum_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, \
+		const unsigned long long seed){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float lr = seg.lr * seg.grad_scale;
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	State *inc = pars_inc + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(inc, &rng, seed, seg.step);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w_i = w[i];
+		float4 inc_i = load_state(inc, i);
+		const float4 g_i = g[i];
+
+		inc_i.x = seg.momentum*inc_i.x - seg.weight_decay*w_i.x - lr*g_i.x;
+		inc_i.y = seg.momentum*inc_i.y - seg.weight_decay*w_i.y - lr*g_i.y;
+		inc_i.z = seg.momentum*inc_i.z - seg.weight_decay*w_i.z - lr*g_i.z;
+		inc_i.w = seg.momentum*inc_i.w - seg.weight_decay*w_i.w - lr*g_i.w;
+		w_i.x += inc_i.x;
+		w_i.y += inc_i.y;
+		w_i.z += inc_i.z;
+		w_i.w += inc_i.w;
+
+		store_state(inc, i, inc_i, &rng);
+		w[i] = w_i;
+	}
+}
+
+template <typename State>
+__global__ void nesterov_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, \
+		const unsigned long long seed){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float lr = seg.lr * seg.grad_scale;
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	State *inc = pars_inc + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(inc, &rng, seed, seg.step);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w4 = w[i];
+		float4 inc4 = load_state(inc, i);
+		const float4 g4 = g[i];
+		float *w_i = reinterpret_cast<float*>(&w4);
+		float *inc_i = reinterpret_cast<float*>(&inc4);
+		const float *g_i = reinterpret_cast<const float*>(&g4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			const float inc_old = inc_i[j];
+			inc_i[j] = seg.momentum*inc_old - seg.weight_decay*w_i[j] - lr*g_i[j];
+			w_i[j] += (1 + seg.momentum)*inc_i[j] - seg.momentum*inc_old;
+		}
+
+		store_state(inc, i, inc4, &rng);
+		w[i] = w4;
+	}
+}
+
+template <typename State>
+__global__ void adam_update(float* pars, State* pars_m, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, const bool is_decoupled, \
+		const unsigned long long seed){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	///> 偏差修正只和段有关，在循环外算好
+	const float correction1 = 1 - powf(beta1, seg.step);
+	const float correction2 = sqrtf(1 - powf(beta2, seg.step));
+	const float scale = correction2 / correction1;
+	const float eps_hat = eps * correction2;
+	///> adamw的decay跟着当前的lr变化，l2项和lr无关
+	const float l2 = is_decoupled ? 0 : seg.decay_coef;
+	const float decay = is_decoupled ? seg.lr * seg.decay_coef : 0;
+
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	State *m = pars_m + seg.start;
+	State *v = pars_v + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(m, &rng, seed, seg.step);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w4 = w[i];
+		float4 m4 = load_state(m, i);
+		float4 v4 = load_state(v, i);
+		const float4 g4 = g[i];
+		float *w_i = reinterpret_cast<float*>(&w4);
+		float *m_i = reinterpret_cast<float*>(&m4);
+		float *v_i = reinterpret_cast<float*>(&v4);
+		const float *g_i = reinterpret_cast<const float*>(&g4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			const float grad = seg.grad_scale*g_i[j] + l2*w_i[j];
+			m_i[j] = beta1*m_i[j] + (1 - beta1)*grad;
+			v_i[j] = beta2*v_i[j] + (1 - beta2)*grad*grad;
+			w_i[j] -= seg.lr*adam_direction(m_i[j], v_i[j], scale, eps_hat) \
+					  + decay*w_i[j];
+		}
+
+		store_state(m, i, m4, &rng);
+		store_state(v, i, v4, &rng);
+		w[i] = w4;
+	}
+}
+
+template <typename State>
+__global__ void rmsprop_update(float* pars, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float rho, \
+		const float eps, const unsigned long long seed){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float l2 = seg.decay_coef;
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	State *v = pars_v + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(v, &rng, seed, seg.step);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w4 = w[i];
+		float4 v4 = load_state(v, i);
+		const float4 g4 = g[i];
+		float *w_i = reinterpret_cast<float*>(&w4);
+		float *v_i = reinterpret_cast<float*>(&v4);
+		const float *g_i = reinterpret_cast<const float*>(&g4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			const float grad = seg.grad_scale*g_i[j] + l2*w_i[j];
+			v_i[j] = rho*v_i[j] + (1 - rho)*grad*grad;
+			w_i[j] -= seg.lr*grad / (sqrtf(v_i[j]) + eps);
+		}
+
+		store_state(v, i, v4, &rng);
+		w[i] = w4;
+	}
+}
+
+__global__ void segment_sq_norms(const float* x, const float* y, \
+		const ParsSegment* segments, float* norms){
+
+	__shared__ float result[UPDATE_BLOCK_SIZE];
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float4 *x4 = reinterpret_cast<const float4*>(x + seg.start);
+	const float4 *y4 = reinterpret_cast<const float4*>(y + seg.start);
+
+	float x_sum = 0;
+	float y_sum = 0;
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		const float4 x_i = x4[i];
+		const float4 y_i = y4[i];
+		x_sum += x_i.x*x_i.x + x_i.y*x_i.y + x_i.z*x_i.z + x_i.w*x_i.w;
+		y_sum += y_i.x*y_i.x + y_i.y*y_i.y + y_i.z*y_i.z + y_i.w*y_i.w;
+	}
+
+	x_sum = block_sum(x_sum, result);
+	if (threadIdx.x == 0)
+		atomicAdd(norms + 2*blockIdx.y, x_sum);
+	__syncthreads();
+	y_sum = block_sum(y_sum, result);
+	if (threadIdx.x == 0)
+		atomicAdd(norms + 2*blockIdx.y + 1, y_sum);
+}
+
+template <typename State>
+__global__ void lars_update(float* pars, State* pars_inc, \
+		const float* derivs, const ParsSegment* segments, const float* norms, \
+		const float eta, const unsigned long long seed){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float l2 = seg.decay_coef;
+	const float w_norm = sqrtf(norms[2*blockIdx.y]);
+	const float g_norm = seg.grad_scale * sqrtf(norms[2*blockIdx.y + 1]);
+	float trust = 1;
+	if (!seg.is_bias && w_norm > 0 && g_norm > 0)
+		trust = eta * w_norm / (g_norm + l2 * w_norm);
+	const float lr = seg.lr * trust;
+
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	State *inc = pars_inc + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(inc, &rng, seed, seg.step);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w4 = w[i];
+		float4 inc4 = load_state(inc, i);
+		const float4 g4 = g[i];
+		float *w_i = reinterpret_cast<float*>(&w4);
+		float *inc_i = reinterpret_cast<float*>(&inc4);
+		const float *g_i = reinterpret_cast<const float*>(&g4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			inc_i[j] = seg.momentum*inc_i[j] \
+					   - lr*(seg.grad_scale*g_i[j] + l2*w_i[j]);
+			w_i[j] += inc_i[j];
+		}
+
+		store_state(inc, i, inc4, &rng);
+		w[i] = w4;
+	}
+}
+
+template <typename State>
+__global__ void lamb_moments(const float* pars, State* pars_m, State* pars_v, \
+		const float* derivs, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, float* norms, \
+		const unsigned long long seed){
+
+	__shared__ float result[UPDATE_BLOCK_SIZE];
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float correction1 = 1 - powf(beta1, seg.step);
+	const float correction2 = sqrtf(1 - powf(beta2, seg.step));
+	const float scale = correction2 / correction1;
+	const float eps_hat = eps * correction2;
+	const float decay = seg.decay_coef;
+
+	const float4 *w = reinterpret_cast<const float4*>(pars + seg.start);
+	State *m = pars_m + seg.start;
+	State *v = pars_v + seg.start;
+	const float4 *g = reinterpret_cast<const float4*>(derivs + seg.start);
+	RoundState rng;
+	init_rounding(m, &rng, seed, seg.step);
+
+	float w_sum = 0;
+	float r_sum = 0;
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		const float4 w4 = w[i];
+		float4 m4 = load_state(m, i);
+		float4 v4 = load_state(v, i);
+		const float4 g4 = g[i];
+		const float *w_i = reinterpret_cast<const float*>(&w4);
+		float *m_i = reinterpret_cast<float*>(&m4);
+		float *v_i = reinterpret_cast<float*>(&v4);
+		const float *g_i = reinterpret_cast<const float*>(&g4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			const float grad = seg.grad_scale*g_i[j];
+			m_i[j] = beta1*m_i[j] + (1 - beta1)*grad;
+			v_i[j] = beta2*v_i[j] + (1 - beta2)*grad*grad;
+			const float r = adam_direction(m_i[j], v_i[j], scale, eps_hat) \
+							+ decay*w_i[j];
+			w_sum += w_i[j]*w_i[j];
+			r_sum += r*r;
+		}
+
+		store_state(m, i, m4, &rng);
+		store_state(v, i, v4, &rng);
+	}
+
+	w_sum = block_sum(w_sum, result);
+	if (threadIdx.x == 0)
+		atomicAdd(norms + 2*blockIdx.y, w_sum);
+	__syncthreads();
+	r_sum = block_sum(r_sum, result);
+	if (threadIdx.x == 0)
+		atomicAdd(norms + 2*blockIdx.y + 1, r_sum);
+}
+
+template <typename State>
+__global__ void lamb_update(float* pars, const State* pars_m, \
+		const State* pars_v, const ParsSegment* segments, const float beta1, \
+		const float beta2, const float eps, const float* norms){
+
+	const ParsSegment seg = segments[blockIdx.y];
+	const float correction1 = 1 - powf(beta1, seg.step);
+	const float correction2 = sqrtf(1 - powf(beta2, seg.step));
+	const float scale = correction2 / correction1;
+	const float eps_hat = eps * correction2;
+	const float decay = seg.decay_coef;
+	const float w_norm = sqrtf(norms[2*blockIdx.y]);
+	const float r_norm = sqrtf(norms[2*blockIdx.y + 1]);
+	float trust = 1;
+	if (!seg.is_bias && w_norm > 0 && r_norm > 0)
+		trust = w_norm / r_norm;
+	const float lr = seg.lr * trust;
+
+	float4 *w = reinterpret_cast<float4*>(pars + seg.start);
+	const State *m = pars_m + seg.start;
+	const State *v = pars_v + seg.start;
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < seg.len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 w4 = w[i];
+		const float4 m4 = load_state(m, i);
+		const float4 v4 = load_state(v, i);
+		float *w_i = reinterpret_cast<float*>(&w4);
+		const float *m_i = reinterpret_cast<const float*>(&m4);
+		const float *v_i = reinterpret_cast<const float*>(&v4);
+
+#pragma unroll
+		for (int j = 0; j < 4; ++j) {
+			w_i[j] -= lr*(adam_direction(m_i[j], v_i[j], scale, eps_hat) \
+					+ decay*w_i[j]);
+		}
+
+		w[i] = w4;
+	}
+}
+
+__global__ void axpby(float* y, const float* x, const float a, const float b, \
+		const int len){
+
+	float4 *y4 = reinterpret_cast<float4*>(y);
+	const float4 *x4 = reinterpret_cast<const float4*>(x);
+
+	for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < len / 4; \
+			i += blockDim.x * gridDim.x) {
+		float4 y_i = y4[i];
+		const float4 x_i = x4[i];
+		y_i.x = a*y_i.x + b*x_i.x;
+		y_i.y = a*y_i.y + b*x_i.y;
+		y_i.z = a*y_i.z + b*x_i.z;
+		y_i.w = a*y_i.w + b*x_i.w;
+		y4[i] = y_i;
+	}
+}
+
+//本文件单独编译，kernel模板在这里对两种状态类型实例化
+#define INSTANTIATE_UPDATE(State) \
+	template __global__ void sgd_momentum_update<State>(float*, State*, \
+			const float*, const ParsSegment*, const unsigned long long); \
+	template __global__ void nesterov_update<State>(float*, State*, \
+			const float*, const ParsSegment*, const unsigned long long); \
+	template __global__ void adam_update<State>(float*, State*, State*, \
+			const float*, const ParsSegment*, const float, const float, \
+			const float, const bool, const unsigned long long); \
+	template __global__ void rmsprop_update<State>(float*, State*, \
+			const float*, const ParsSegment*, const float, const float, \
+			const unsigned long long); \
+	template __global__ void lars_update<State>(float*, State*, \
+			const float*, const ParsSegment*, const float*, const float, \
+			const unsigned long long); \
+	template __global__ void lamb_moments<State>(const float*, State*, State*, \
+			const float*, const ParsSegment*, const float, const float, \
+			const float, float*, const unsigned long long); \
+	template __global__ void lamb_update<State>(float*, const State*, \
+			const State*, const ParsSegment*, const float, const float, \
+			const float, const float*);
+
+INSTANTIATE_UPDATE(float)
+INSTANTIATE_UPDATE(bf16)
@@ -9,10 +9,12 @@ using namespace std;
 template <typename Dtype>
 PoolingLayer<Dtype>::PoolingLayer(PoolParam *lcp){
 	this->_lcp = lcp;
-	_num_box = _lcp->getBoxNumHeight()*_lcp->getBoxNumWidth();
-
-	cublasCreate(&this->handle);
-	
+	_forward_thread = MAX_NUM_THREAD;
+	_backward_thread = MAX_NUM_THREAD;
+	if(_lcp->isTuned()){
+		setForwardConfig(_lcp->getForwardConfig());
+		setBackwardConfig(_lcp->getBackwardConfig());
+	}
 }
 
 template <typename Dtype>
@@ -23,11 +25,6 @@ PoolingLayer<Dtype>::~PoolingLayer() {
 
 	if(_lcp->getPoolType() == MAX_POOLING )
 		delete _max_pos;
-	if((_lcp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _lcp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_lcp->getOverlapHeight() > 0 || _lcp->getOverlapWidth() > 0))
-		delete unranged_dE_dx;
-	cublasDestroy(this->handle);
 }
 
 template <typename Dtype>
@@ -41,56 +38,41 @@ void PoolingLayer<Dtype>::initCuda() {
 
 
 	if(_lcp->getPoolType() == MAX_POOLING ){
-		_max_pos           = new Matrix<int>(_lcp->getMinibatchSize(), \
+		assert(_lcp->getFilterHeight()*_lcp->getFilterWidth() <= 256);
+		_max_pos           = new Matrix<unsigned char>(_lcp->getMinibatchSize(), \
 			_lcp->getOutHeight()*_lcp->getOutWidth()* _lcp->getOutChannel());
 
 	}
-	if((_lcp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _lcp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_lcp->getOverlapHeight() > 0 || _lcp->getOverlapWidth() > 0)){
-		unranged_dE_dx = new Matrix<Dtype>(_lcp->getMinibatchSize(), \
-				_lcp->getBoxInHeight()*_lcp->getBoxInWidth() \
-				* _lcp->getBoxNumHeight()*_lcp->getBoxNumWidth() \
-				* _lcp->getOutChannel());
-	}
 
 }
 
 template <typename Dtype>
 void PoolingLayer<Dtype>::computeOutput(Matrix<Dtype>* x){
 
-	this->_y->zeros();	
-
-	dim3 blocks = dim3(_lcp->getMinibatchSize(), _lcp->getInChannel() * _num_box);
-	dim3 threads = dim3(_lcp->getThreadWidth(), _lcp->getThreadHeight()); 
+	int num_kernel = this->_y->getNumEles();
+	int num_block = this->getNumBlock(num_kernel, _forward_thread);
 
 	if(_lcp->getPoolType() == MAX_POOLING ){
-		max_pooling<<<blocks, threads>>>(x->getDevData(), \
-				this->_y->getDevData(), _max_pos->getDevData(), \
+		max_pooling<<<num_block, _forward_thread>>>(x->getDevData(), \
+				this->_y->getDevData(), _max_pos->getDevData(), num_kernel, \
 				_lcp->getInHeight(), _lcp->getInWidth(), \
-				_lcp->getInChannel(), \
 				_lcp->getOutHeight(), _lcp->getOutWidth(), \
 				_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
-				_lcp->getStrideHeight(), _lcp->getStrideWidth(), \
-				_lcp->getBoxOutHeight(), _lcp->getBoxOutWidth(), \
-				_lcp->getBoxNumHeight(), _lcp->getBoxNumWidth());  
+				_lcp->getStrideHeight(), _lcp->getStrideWidth());  
 
 	}else if(_lcp->getPoolType() == AVG_POOLING){
-		avg_pooling<<<blocks, threads>>>(x->getDevData(), \
-				this->_y->getDevData(), \
+		avg_pooling<<<num_block, _forward_thread>>>(x->getDevData(), \
+				this->_y->getDevData(), num_kernel, \
 				_lcp->getInHeight(), _lcp->getInWidth(), \
-				_lcp->getInChannel(), \
 				_lcp->getOutHeight(), _lcp->getOutWidth(), \
 				_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
-				_lcp->getStrideHeight(), _lcp->getStrideWidth(), \
-				_lcp->getBoxOutHeight(), _lcp->getBoxOutWidth(), \
-				_lcp->getBoxNumHeight(), _lcp->getBoxNumWidth());  
+				_lcp->getStrideHeight(), _lcp->getStrideWidth());  
 	}else{
 		cout << "Pooling type is invalid !\n";	
 		exit(EXIT_FAILURE);
 	}
 
-	cudaThreadSynchronize();
+	cudaStreamSynchronize(cudaStreamPerThread);
 	cudaCheckError();
 
 }
@@ -98,75 +80,34 @@ void PoolingLayer<Dtype>::computeOutput(Matrix<Dtype>* x){
 template <typename Dtype>
 void PoolingLayer<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
 
-	dim3 blocks = dim3(_lcp->getMinibatchSize(), _lcp->getInChannel() * _num_box);
-	dim3 threads = dim3(_lcp->getThreadWidth(), _lcp->getThreadHeight());
-
-	int box_in_height = MAX_THREAD_SIZE > _lcp->getOutHeight() \
-				? _lcp->getInHeight() : _lcp->getBoxInHeight();
-	int box_in_width = MAX_THREAD_SIZE > _lcp->getOutWidth() \
-				? _lcp->getInWidth() : _lcp->getBoxInWidth();
-
-	Dtype* p_dE_dx;
-	if((_lcp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _lcp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_lcp->getOverlapHeight() > 0 || _lcp->getOverlapWidth() > 0)){
-		unranged_dE_dx->zeros();
-		p_dE_dx = unranged_dE_dx->getDevData();
-	}else{
-		dE_dx->zeros();
-		p_dE_dx = dE_dx->getDevData();
-	}
+	int num_kernel = dE_dx->getNumEles();
+	int num_block = this->getNumBlock(num_kernel, _backward_thread);
 
 	if(_lcp->getPoolType() == MAX_POOLING ){
-		compute_dE_dy_max<<<blocks, threads, \
-			sizeof(Dtype)*box_in_height*box_in_width>>>( \
-					this->_dE_dy->getDevData(), \
-					p_dE_dx, _max_pos->getDevData(), \
-					box_in_height, box_in_width, \
-					_lcp->getBoxOutHeight(), _lcp->getBoxOutWidth(), \
-					_lcp->getInChannel(), \
-					_lcp->getOutHeight(), _lcp->getOutWidth(), \
-					_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
-					_lcp->getStrideHeight(), _lcp->getStrideWidth(), \
-					_lcp->getBoxNumHeight(), _lcp->getBoxNumWidth());  
-		cudaThreadSynchronize();
-		cudaCheckError();
-
+		compute_dE_dy_max<<<num_block, _backward_thread>>>( \
+				this->_dE_dy->getDevData(), dE_dx->getDevData(), \
+				_max_pos->getDevData(), num_kernel, \
+				_lcp->getInHeight(), _lcp->getInWidth(), \
+				_lcp->getOutHeight(), _lcp->getOutWidth(), \
+				_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
+				_lcp->getStrideHeight(), _lcp->getStrideWidth());
 
 	}else if(_lcp->getPoolType() == AVG_POOLING){
-		compute_dE_dy_avg<<<blocks, threads, \
-			sizeof(Dtype)*box_in_height*box_in_width>>>( \
-					this->_dE_dy->getDevData(), p_dE_dx, \
-					box_in_height, box_in_width, \
-					_lcp->getBoxOutHeight(), _lcp->getBoxOutWidth(), \
-					_lcp->getInChannel(), \
-					_lcp->getOutHeight(), _lcp->getOutWidth(), \
-					_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
-					_lcp->getStrideHeight(), _lcp->getStrideWidth(), \
-					_lcp->getBoxNumHeight(), _lcp->getBoxNumWidth());  
-		cudaThreadSynchronize();
-		cudaCheckError();
+		compute_dE_dy_avg<<<num_block, _backward_thread>>>( \
+				this->_dE_dy->getDevData(), dE_dx->getDevData(), \
+				num_kernel, \
+				_lcp->getInHeight(), _lcp->getInWidth(), \
+				_lcp->getOutHeight(), _lcp->getOutWidth(), \
+				_lcp->getFilterHeight(), _lcp->getFilterWidth(), \
+				_lcp->getStrideHeight(), _lcp->getStrideWidth());
 
 	}else{
 		cout << "Pooling type is invalid !\n";	
 		exit(EXIT_FAILURE);
 	}
 
-	if((_lcp->getOutHeight() > MAX_THREAD_SIZE \
-				|| _lcp->getOutWidth() > MAX_THREAD_SIZE) \
-			&& (_lcp->getOverlapHeight() > 0 || _lcp->getOverlapWidth() > 0)){
-		dE_dx->zeros();
-
-		compactOverlap<<<_lcp->getMinibatchSize(), _lcp->getInChannel()>>>( \
-				unranged_dE_dx->getDevData(), dE_dx->getDevData(), \
-				_lcp->getInHeight(), _lcp->getInWidth(), \
-				_lcp->getInChannel(),  _lcp->getOverlapHeight(), \
-				_lcp->getOverlapWidth(), \
-				box_in_height, box_in_width, \
-				_lcp->getBoxNumHeight(), _lcp->getBoxNumWidth());  
-		cudaThreadSynchronize();
-		cudaCheckError();
-	}
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
 }
 
 
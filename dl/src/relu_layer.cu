@@ -9,10 +9,13 @@ template <typename Dtype>
 ReluLayer<Dtype>::ReluLayer(Param* p){
 
 	this->_p           = p;
+	this->_producer    = NULL;
 }
 
 template <typename Dtype>
 ReluLayer<Dtype>::~ReluLayer() {
+	if(_producer != NULL)
+		return;
 	delete  this->_y; 
 	delete  this->_dE_dy;
 	delete _record;
@@ -21,6 +24,12 @@ ReluLayer<Dtype>::~ReluLayer() {
 template <typename Dtype>
 void ReluLayer<Dtype>::initCuda() {
 
+	if(_producer != NULL){
+		this->_y         = _producer->getY();
+		this->_dE_dy     = _producer->getDEDY();
+		_record          = NULL;
+		return;
+	}
 
 	ConnectType ct = this->_p->getConnectType();
 	int col;
@@ -40,15 +49,25 @@ void ReluLayer<Dtype>::initCuda() {
 template <typename Dtype>
 void ReluLayer<Dtype>::computeOutput(Matrix<Dtype>* x){ 
 
-	this->_y->zeros();	
+	///> 合并时卷积层已经写入了relu以后的值
+	if(_producer != NULL)
+		return;
 	x->applyRelu(this->_y, _record);
 	
 }
 
 template <typename Dtype>
 void ReluLayer<Dtype>::computeDerivsOfInput(Matrix<Dtype>* dE_dx){
-	dE_dx->zeros();
 
+	///> 合并时dE_dx就是本层的_dE_dy，输出大于0的位置就是输入大于0的位置
+	if(_producer != NULL){
+		const int num_kernel = dE_dx->getNumEles();
+		relu_mask_back<<<this->getNumBlock(num_kernel, MAX_NUM_THREAD), \
+			MAX_NUM_THREAD>>>(this->_y->getDevData(), dE_dx->getDevData(), num_kernel);
+		cudaStreamSynchronize(cudaStreamPerThread);
+		cudaCheckError();
+		return;
+	}
 	this->_dE_dy->applyRelu(dE_dx, _record, false);
 
 }
@@ -10,11 +10,26 @@
 
 using namespace std;
 
+template <typename Dtype>
+TrainClassification<Dtype>::~TrainClassification() {
+	if(_master == this && this->_workers.size() > 0){
+		for(int i = 1; i < this->_workers.size(); i++)
+			delete this->_workers[i];
+		pthread_barrier_destroy(&_barrier);
+		if(_stage_begin.size() > 0){
+			pthread_cond_destroy(&_stage_cond);
+			pthread_mutex_destroy(&_stage_mutex);
+		}
+	}
+}
+
 template <typename Dtype>
 void TrainClassification<Dtype>::createPixelAndLabel(){
-	this->_model_component->_mini_data = new Matrix<Dtype>(this->_model_component->_minibatch_size, \
+	this->_model_component->_mini_data = new Matrix<Dtype>( \
+				this->_model_component->getWorkerMinibatchSize(), \
 				this->_model_component->_one_img_len);
-	this->_model_component->_mini_label	= new Matrix<int>(this->_model_component->_minibatch_size, 1);
+	this->_model_component->_mini_label	= new Matrix<int>( \
+				this->_model_component->getWorkerMinibatchSize(), 1);
 }
 
 template <typename Dtype>
@@ -27,11 +42,79 @@ void TrainClassification<Dtype>::parseImgBinary(string train_file, string valid_
 
 }
 
+/// 主模型建好以后调用，每个副本有自己的输出和导数，权重使用主模型的。
+/// 流水线时每个副本是一个micro-batch，线程按段而不是按副本创建
+template <typename Dtype>
+void TrainClassification<Dtype>::createWorkers(){
+	ModelComponent<Dtype> *mc = this->_model_component;
+	this->_workers.push_back(this);
+
+	for(int i = 1; i < mc->_num_worker; i++){
+		TrainClassification<Dtype> *worker = new TrainClassification<Dtype>( \
+				this->_has_valid, this->_is_test);
+		ModelComponent<Dtype> *wmc = worker->_model_component;
+		worker->_master = this;
+		worker->_worker_idx = i;
+		worker->_optimizer = this->_optimizer;
+
+		///> 层的参数和主模型相同，层和数据重新创建
+		*wmc = *mc;
+		wmc->_layers.clear();
+		wmc->_layers_needed_train.clear();
+		wmc->_w.clear();
+		wmc->_bias.clear();
+		wmc->_w_len.clear();
+		wmc->_bias_len.clear();
+		wmc->_dE_dw.clear();
+		wmc->_dE_db.clear();
+		wmc->_y.clear();
+		wmc->_dE_dy.clear();
+		wmc->_y_needed_train.clear();
+		wmc->_dE_dy_scratch.clear();
+
+		///> 每个副本的dropout按worker号使用不同的随机数
+		worker->createLayer();
+		///> 参数使用主模型的，只有导数是自己的
+		worker->createWBias(this);
+		worker->createPixelAndLabel();
+		worker->createYDEDY();
+
+		this->_workers.push_back(worker);
+	}
+	for(int i = 1; i < this->_workers.size(); i++)
+		static_cast<TrainClassification<Dtype>* >(this->_workers[i])->_workers \
+			= this->_workers;
+
+	if(mc->isPipeline()){
+		createStages();
+		pthread_barrier_init(&_barrier, NULL, _stage_args.size());
+	}else{
+		pthread_barrier_init(&_barrier, NULL, mc->_num_worker);
+	}
+}
+
+/// 按层数把_layers平均切成几段，段数不超过层数，最后一段包含输出层
+template <typename Dtype>
+void TrainClassification<Dtype>::createStages(){
+	ModelComponent<Dtype> *mc = this->_model_component;
+	const int num_stage = min(mc->_num_stage, mc->_num_layers);
+
+	_stage_begin.resize(num_stage + 1);
+	for(int s = 0; s <= num_stage; s++)
+		_stage_begin[s] = s * mc->_num_layers / num_stage;
+	_forward_done.assign(num_stage, 0);
+	_backward_done.assign(num_stage, 0);
+	for(int s = 0; s < num_stage; s++)
+		_stage_args.push_back(make_pair(this, s));
+
+	pthread_mutex_init(&_stage_mutex, NULL);
+	pthread_cond_init(&_stage_cond, NULL);
+}
+
 template <typename Dtype>
 void TrainClassification<Dtype>::forwardLastLayer(){
 
-	this->_model_component->_layers[this->_model_component->_num_layers-1]->computeOutput(\
-			this->_model_component->_y[this->_model_component->_num_layers-1]);
+	this->forwardLayer(this->_model_component->_num_layers-1);
 	this->_likelihood += dynamic_cast<Logistic<Dtype>* >( \
 			this->_model_component->_layers[this->_model_component->_num_layers-1]) \
 						 ->computeError(this->_model_component->_mini_label, this->_error);
@@ -41,21 +124,181 @@ template <typename Dtype>
 void TrainClassification<Dtype>::backwardLastLayer(){
 	Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
 			this->_model_component->_layers[this->_model_component->_num_layers-1]);
+	///> 最后一层的输入只被它使用，导数直接写进输入的dE_dy
 	last_layer->computeDerivsOfInput(this->_model_component->_dE_dy[ \
-			this->_model_component->_num_layers-2], \
+			this->_model_component->_bottoms[this->_model_component->_num_layers-1][0]-1], \
 			this->_model_component->_mini_label);
 }
 
+/// 0号worker把整个minibatch读到主机缓存，每个worker再拷贝自己的那一段，
+/// hogwild时每个worker直接拷贝自己的整个minibatch，不等其他worker
+template <typename Dtype>
+void TrainClassification<Dtype>::loadOneBatch(bool is_train, int batch_idx){
+	ModelComponent<Dtype> *mc = this->_model_component;
+	int pixel_len = mc->getWorkerMinibatchSize()*mc->_one_img_len;
+	int label_len = mc->getWorkerMinibatchSize();
+
+	if(mc->_is_hogwild){
+		Dtype* pixel;
+		int* label;
+		if(is_train)
+			_master->_load_layer->loadTrainOneBatch(batch_idx, pixel, label);
+		else
+			_master->_load_layer->loadValidOneBatch(batch_idx, pixel, label);
+		mc->_mini_data->copyFromHost(pixel, pixel_len);
+		mc->_mini_label->copyFromHost(label, label_len);
+		return;
+	}
+
+	if(this->_worker_idx == 0){
+		if(is_train)
+			this->_load_layer->loadTrainOneBatch(batch_idx, _h_mini_pixel, _h_mini_label);
+		else
+			this->_load_layer->loadValidOneBatch(batch_idx, _h_mini_pixel, _h_mini_label);
+	}
+	pthread_barrier_wait(&_master->_barrier);
+
+	mc->_mini_data->copyFromHost(_master->_h_mini_pixel \
+			+ this->_worker_idx*pixel_len, pixel_len);
+	mc->_mini_label->copyFromHost(_master->_h_mini_label \
+			+ this->_worker_idx*label_len, label_len);
+	///> 所有worker拷贝完以后才能读下一个minibatch
+	pthread_barrier_wait(&_master->_barrier);
+}
+
+/// 把其他worker的likelihood、error和分类记录累加到0号worker
+template <typename Dtype>
+void TrainClassification<Dtype>::mergeWorkerResult(){
+	const int last_idx = this->_model_component->_num_layers-1;
+	Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
+			this->_model_component->_layers[last_idx]);
+	for(int i = 1; i < this->_workers.size(); i++){
+		TrainClassification<Dtype> *worker = \
+			static_cast<TrainClassification<Dtype>* >(this->_workers[i]);
+		this->_likelihood += worker->_likelihood;
+		this->_error += worker->_error;
+		last_layer->mergeRecord(dynamic_cast<Logistic<Dtype>* >( \
+					worker->_model_component->_layers[last_idx]));
+	}
+}
+
+/// 流水线时由0段线程把所有副本的统计清零
+template <typename Dtype>
+void TrainClassification<Dtype>::resetWorkerResult(){
+	const int last_idx = this->_model_component->_num_layers-1;
+	for(int i = 0; i < this->_workers.size(); i++){
+		TrainClassification<Dtype> *worker = \
+			static_cast<TrainClassification<Dtype>* >(this->_workers[i]);
+		worker->_likelihood = 0;
+		worker->_error = 0;
+		dynamic_cast<Logistic<Dtype>* >(worker->_model_component->_layers[last_idx]) \
+			->setRecordToZero();
+	}
+}
+
+template <typename Dtype>
+void TrainClassification<Dtype>::printTrainResult(const int epoch_idx, \
+		const int num_train_batch){
+	Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
+			this->_model_component->_layers[this->_model_component->_num_layers-1]);
+	mergeWorkerResult();
+	cout << "----------epoch_idx: " << epoch_idx << "-----------\n";
+	cout << "training likelihood: " << this->_likelihood << endl;
+	cout << "classification training accuarcy: " << 1-(float)this->_error/ \
+		(num_train_batch*this->_model_component->getMinibatchSize()) << endl;
+	Matrix<int>* train_record = last_layer->getResultRecord();
+	train_record->showValue("train record");
+	if(this->_model_component->_is_hogwild){
+		int num_stale_skip = 0;
+		for(int i = 0; i < this->_workers.size(); i++)
+			num_stale_skip += static_cast<TrainClassification<Dtype>* >( \
+					this->_workers[i])->_num_stale_skip;
+		cout << "stale updates skipped: " << num_stale_skip << endl;
+	}
+}
+
+template <typename Dtype>
+void TrainClassification<Dtype>::printValidResult(){
+	Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
+			this->_model_component->_layers[this->_model_component->_num_layers-1]);
+	mergeWorkerResult();
+	Matrix<int>* valid_record = last_layer->getResultRecord();
+	valid_record->showValue("valid record");
+
+	cout << "validation likelihood: " << this->_likelihood << endl;
+	cout << "classification valid accuarcy: " << 1-(float)this->_error/ \
+		(this->_model_component->_num_valid_batch \
+		 *this->_model_component->getMinibatchSize()) << endl;
+}
+
+template <typename Dtype>
+void* TrainClassification<Dtype>::runWorker(void* model){
+	Engine::getInstance()->pinThread();
+	static_cast<TrainClassification<Dtype>* >(model)->trainWorker();
+	return NULL;
+}
+
 template <typename Dtype>
 void TrainClassification<Dtype>::train() {
 
+	if(this->_workers.size() == 0)
+		createWorkers();
+
+	Engine *engine = Engine::getInstance();
+	_h_mini_pixel = static_cast<Dtype*>(engine->allocHost(sizeof(Dtype) \
+				*this->_model_component->_minibatch_size \
+				*this->_model_component->_one_img_len));   //分配在本节点的主机内存上
+	_h_mini_label = static_cast<int*>(engine->allocHost(sizeof(int) \
+				*this->_model_component->_minibatch_size));
+	///> 读数据时这两个指针会指向数据集里的minibatch，释放分配时的地址
+	Dtype *alloc_pixel = _h_mini_pixel;
+	int *alloc_label = _h_mini_label;
+
+	const bool is_pipeline = this->_model_component->isPipeline();
+	const int num_thread = is_pipeline ? _stage_args.size() : this->_workers.size();
+	vector<pthread_t> threads(num_thread);
+	for(int i = 1; i < num_thread; i++){
+		if(is_pipeline)
+			pthread_create(&threads[i], NULL, runStage, &_stage_args[i]);
+		else
+			pthread_create(&threads[i], NULL, runWorker, this->_workers[i]);
+	}
+	if(is_pipeline)
+		trainStage(0);
+	else
+		trainWorker();
+	for(int i = 1; i < num_thread; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	engine->freeHost(alloc_pixel);
+	engine->freeHost(alloc_label);
+}
+
+/// 每个worker线程执行一遍，统计结果由0号worker汇总输出
+template <typename Dtype>
+void TrainClassification<Dtype>::trainWorker() {
+
 	clock_t t;
 	t = clock();
 
-	int pixel_len = this->_model_component->_minibatch_size*this->_model_component->_one_img_len;
-	int label_len = this->_model_component->_minibatch_size;
-	Dtype *h_mini_pixel = new Dtype[pixel_len];   //分配在主机内存上
-	int *h_mini_label = new int[label_len]; 
+	pthread_barrier_t *barrier = &_master->_barrier;
+	Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
+			this->_model_component->_layers[this->_model_component->_num_layers-1]);
+
+	///> 多进程时每个进程读第rank, rank+num_process, ...个minibatch，
+	///> 验证和输出只在0号进程上做。有按列切分的层时所有进程读相同的minibatch，
+	///> 一起做验证，只在0号进程输出
+	Communicator *comm = _master->_comm;
+	const bool is_same_data = comm == NULL || this->_model_component->_is_tensor_parallel;
+	const int rank = is_same_data ? 0 : comm->getRank();
+	const int num_process = is_same_data ? 1 : comm->getNumProcess();
+	const bool is_print = this->_worker_idx == 0 && (comm == NULL || comm->getRank() == 0);
+	const int num_train_batch = this->_model_component->_num_train_batch / num_process;
+	///> hogwild时第i个worker训练和验证第i, i+num_worker, ...个minibatch
+	const bool is_hogwild = this->_model_component->_is_hogwild;
+	const int batch_start = is_hogwild ? this->_worker_idx : 0;
+	const int batch_step = is_hogwild ? this->_workers.size() : 1;
 
 	for (int epoch_idx = 0; epoch_idx < this->_model_component->_num_epoch; \
 			epoch_idx++) {
@@ -63,70 +306,236 @@ void TrainClassification<Dtype>::train() {
 		this->_likelihood = 0;
 		this->_error = 0;
 
-		Logistic<Dtype> *last_layer = dynamic_cast<Logistic<Dtype>* >( \
-				this->_model_component->_layers[this->_model_component->_num_layers-1]);
 		last_layer->setRecordToZero();
 
+		if(this->_worker_idx == 0)
+			this->warmupLR(epoch_idx);
 
-		for(int batch_idx = 0; batch_idx < this->_model_component->_num_train_batch; \
-				batch_idx++){
+		for(int batch_idx = batch_start; batch_idx < num_train_batch; \
+				batch_idx += batch_step){
 
-			this->_load_layer->loadTrainOneBatch(batch_idx, h_mini_pixel, h_mini_label);
-			this->_model_component->_mini_data->copyFromHost(h_mini_pixel, \
-						pixel_len);
-			this->_model_component->_mini_label->copyFromHost(h_mini_label, \
-						label_len);
+			loadOneBatch(true, batch_idx*num_process + rank);
 			this->forwardPropagate();
 			forwardLastLayer();
 			backwardLastLayer();
 			this->backwardPropagate();
-			
-			this->computeAndUpdatePars();
-
-			if(batch_idx == this->_model_component->_num_train_batch-1){
-				cout << "----------epoch_idx: " << epoch_idx << "-----------\n";
-				cout << "training likelihood: " << this->_likelihood << endl;
-				cout << "classification training accuarcy: " << 1-(float)this->_error/ \
-					(this->_model_component->_num_train_batch \
-					 *this->_model_component->getMinibatchSize()) << endl;
-				Matrix<int>* train_record = last_layer->getResultRecord();
-				train_record->showValue("train record");
-
-				this->_likelihood = 0;
-				this->_error = 0;
-
-				last_layer->setRecordToZero();
-
-				for(int valid_idx = 0; \
-						valid_idx < this->_model_component->_num_valid_batch; \
-						valid_idx++){
-						
-					this->_load_layer->loadValidOneBatch( valid_idx, \
-						h_mini_pixel, h_mini_label);
-					this->_model_component->_mini_data->copyFromHost(h_mini_pixel, \
-						pixel_len);
-					this->_model_component->_mini_label->copyFromHost(h_mini_label, \
-						label_len);
-
-					this->forwardPropagate();
-					forwardLastLayer();
-
-				}
-				Matrix<int>* valid_record = last_layer->getResultRecord();
-				valid_record->showValue("valid record");
-
-				cout << "validation likelihood: " << this->_likelihood << endl;
-				cout << "classification valid accuarcy: " << 1-(float)this->_error/ \
-					(this->_model_component->_num_valid_batch \
-					 *this->_model_component->getMinibatchSize()) << endl;
 
+			///> hogwild时每层在反向传播中已经直接更新了共享参数
+			if(is_hogwild)
+				continue;
+
+			///> 每个worker平均一段导数，然后0号worker做进程间平均并更新全部参数，
+			///> 下一个minibatch载入时的barrier保证更新完成后才开始前向
+			pthread_barrier_wait(barrier);
+			this->reduceDerivsOfPars();
+			pthread_barrier_wait(barrier);
+			if(this->_worker_idx == 0)
+				this->allReduceDerivsOfPars();
+			this->updatePars();
+		}
+
+		if(rank == 0){
+			pthread_barrier_wait(barrier);
+			if(is_print)
+				printTrainResult(epoch_idx, num_train_batch);
+			pthread_barrier_wait(barrier);
+
+			this->_likelihood = 0;
+			this->_error = 0;
+
+			last_layer->setRecordToZero();
+
+			for(int valid_idx = batch_start; \
+					valid_idx < this->_model_component->_num_valid_batch; \
+					valid_idx += batch_step){
+					
+				loadOneBatch(false, valid_idx);
+				this->forwardPropagate();
+				forwardLastLayer();
 
 			}
+
+			pthread_barrier_wait(barrier);
+			if(is_print)
+				printValidResult();
+			pthread_barrier_wait(barrier);
 		}
 
-		t = clock() - t;
-		cout << ((float)t/CLOCKS_PER_SEC) << "s.\n";
-		t = clock();
+		if(is_print){
+			t = clock() - t;
+			cout << ((float)t/CLOCKS_PER_SEC) << "s.\n";
+			t = clock();
+		}
 
 	}
 }
+
+template <typename Dtype>
+void* TrainClassification<Dtype>::runStage(void* arg){
+	pair<TrainClassification<Dtype>*, int> *stage_arg = \
+		static_cast<pair<TrainClassification<Dtype>*, int>* >(arg);
+	Engine::getInstance()->pinThread();
+	stage_arg->first->trainStage(stage_arg->second);
+	return NULL;
+}
+
+/// 流水线时每段一个线程执行一遍，所有micro-batch的导数算完以后求平均再更新，
+/// 相当于把minibatch的导数分几次累加，统计结果由0段线程汇总输出
+template <typename Dtype>
+void TrainClassification<Dtype>::trainStage(const int stage) {
+
+	clock_t t;
+	t = clock();
+
+	const int num_stage = _stage_begin.size() - 1;
+	const int num_micro = this->_workers.size();
+
+	Communicator *comm = this->_comm;
+	const int rank = comm == NULL ? 0 : comm->getRank();
+	const int num_process = comm == NULL ? 1 : comm->getNumProcess();
+	const int num_train_batch = this->_model_component->_num_train_batch / num_process;
+
+	for (int epoch_idx = 0; epoch_idx < this->_model_component->_num_epoch; \
+			epoch_idx++) {
+
+		if(stage == 0){
+			resetWorkerResult();
+			this->warmupLR(epoch_idx);
+		}
+
+		for(int batch_idx = 0; batch_idx < num_train_batch; batch_idx++){
+
+			runPipeline(stage, true, batch_idx*num_process + rank);
+
+			///> 每段线程把几个micro-batch负责的那段导数平均到主模型的导数里，
+			///> 然后0段线程做进程间平均并更新全部参数，
+			///> 下一个minibatch开始时的barrier保证更新完成后才开始前向
+			pthread_barrier_wait(&_barrier);
+			for(int m = stage; m < num_micro; m += num_stage)
+				this->_workers[m]->reduceDerivsOfPars();
+			pthread_barrier_wait(&_barrier);
+			if(stage == 0){
+				this->allReduceDerivsOfPars();
+				this->updatePars();
+			}
+		}
+
+		if(rank == 0){
+			pthread_barrier_wait(&_barrier);
+			if(stage == 0){
+				printTrainResult(epoch_idx, num_train_batch);
+				resetWorkerResult();
+			}
+
+			for(int valid_idx = 0; \
+					valid_idx < this->_model_component->_num_valid_batch; \
+					valid_idx++){
+				runPipeline(stage, false, valid_idx);
+			}
+
+			pthread_barrier_wait(&_barrier);
+			if(stage == 0)
+				printValidResult();
+		}
+
+		if(stage == 0 && rank == 0){
+			t = clock() - t;
+			cout << ((float)t/CLOCKS_PER_SEC) << "s.\n";
+			t = clock();
+		}
+	}
+}
+
+/// 一个minibatch流过第stage段。gpipe先做完所有micro-batch的前向再反向，
+/// 1f1b只做够填满后面几段的前向，然后前向和反向交替，输出更早被反向用掉
+template <typename Dtype>
+void TrainClassification<Dtype>::runPipeline(const int stage, bool is_train, \
+		int batch_idx){
+	const int num_stage = _stage_begin.size() - 1;
+	const int num_micro = this->_workers.size();
+
+	pthread_barrier_wait(&_barrier);
+	if(stage == 0){
+		fill(_forward_done.begin(), _forward_done.end(), 0);
+		fill(_backward_done.begin(), _backward_done.end(), 0);
+		if(is_train)
+			this->_load_layer->loadTrainOneBatch(batch_idx, _h_mini_pixel, _h_mini_label);
+		else
+			this->_load_layer->loadValidOneBatch(batch_idx, _h_mini_pixel, _h_mini_label);
+	}
+	pthread_barrier_wait(&_barrier);
+
+	int num_warmup = num_micro;
+	if(is_train && this->_model_component->_pipeline_schedule == ONE_F_ONE_B)
+		num_warmup = min(num_stage - 1 - stage, num_micro);
+	for(int m = 0; m < num_warmup; m++)
+		forwardMicroBatch(stage, m);
+	if(!is_train)
+		return;
+
+	int num_forward = num_warmup;
+	for(int m = 0; m < num_micro; m++){
+		if(num_forward < num_micro)
+			forwardMicroBatch(stage, num_forward++);
+		backwardMicroBatch(stage, m);
+	}
+}
+
+/// 0段把第m段minibatch拷贝给第m个副本，其他段等上一段算完这个micro-batch
+template <typename Dtype>
+void TrainClassification<Dtype>::forwardMicroBatch(const int stage, const int m){
+	const int num_stage = _stage_begin.size() - 1;
+	TrainClassification<Dtype> *micro = \
+		static_cast<TrainClassification<Dtype>* >(this->_workers[m]);
+	ModelComponent<Dtype> *mc = micro->_model_component;
+
+	if(stage == 0){
+		int pixel_len = mc->getWorkerMinibatchSize()*mc->_one_img_len;
+		int label_len = mc->getWorkerMinibatchSize();
+		mc->_mini_data->copyFromHost(_h_mini_pixel + m*pixel_len, pixel_len);
+		mc->_mini_label->copyFromHost(_h_mini_label + m*label_len, label_len);
+	}else{
+		waitStage(_forward_done, stage-1, m);
+	}
+
+	micro->forwardLayers(_stage_begin[stage], _stage_begin[stage+1]);
+	if(stage == num_stage-1)
+		micro->forwardLastLayer();
+	///> 下一段在另一个线程上读这一段的输出
+	cudaStreamSynchronize(cudaStreamPerThread);
+	signalStage(_forward_done, stage);
+}
+
+template <typename Dtype>
+void TrainClassification<Dtype>::backwardMicroBatch(const int stage, const int m){
+	const int num_stage = _stage_begin.size() - 1;
+	TrainClassification<Dtype> *micro = \
+		static_cast<TrainClassification<Dtype>* >(this->_workers[m]);
+
+	if(stage == num_stage-1)
+		micro->backwardLastLayer();
+	else
+		waitStage(_backward_done, stage+1, m);
+
+	micro->backwardLayers(_stage_begin[stage], _stage_begin[stage+1]);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	signalStage(_backward_done, stage);
+}
+
+/// 等第stage段做完第m个micro-batch
+template <typename Dtype>
+void TrainClassification<Dtype>::waitStage(vector<int>& done, const int stage, \
+		const int m){
+	pthread_mutex_lock(&_stage_mutex);
+	while(done[stage] <= m)
+		pthread_cond_wait(&_stage_cond, &_stage_mutex);
+	pthread_mutex_unlock(&_stage_mutex);
+}
+
+template <typename Dtype>
+void TrainClassification<Dtype>::signalStage(vector<int>& done, const int stage){
+	pthread_mutex_lock(&_stage_mutex);
+	done[stage]++;
+	pthread_cond_broadcast(&_stage_cond);
+	pthread_mutex_unlock(&_stage_mutex);
+}
@@ -13,11 +13,34 @@
 #include "sigmoid_layer.hpp"
 #include "relu_layer.hpp"
 #include "convnet.hpp"
+#include "eltwise_layer.hpp"
+#include "concat_layer.hpp"
 #include "pooling_layer.hpp"
 #include "dropout_layer.hpp"
 
 using namespace std;
 
+template <typename Dtype>
+struct ScaleRangeArg {
+	Dtype* data;
+	float scale;
+};
+
+template <typename Dtype>
+static void scaleRange(void* arg, const int begin, const int end){
+	ScaleRangeArg<Dtype>* sa = static_cast<ScaleRangeArg<Dtype>*>(arg);
+	for (int i = begin; i < end; ++i)
+		sa->data[i] *= sa->scale;
+}
+
+/// 主机缓存的[begin, end)乘以scale，交给engine的线程池分段执行
+template <typename Dtype>
+static void scaleHost(Dtype* data, const int begin, const int end, const float scale){
+	ScaleRangeArg<Dtype> arg = {data, scale};
+	Engine::getInstance()->parallelFor(begin, end, HOST_GRAIN_SIZE, \
+			scaleRange<Dtype>, &arg);
+}
+
 template <typename Dtype>
 TrainModel<Dtype>::TrainModel(bool has_valid, bool is_test){
 	_model_component = new ModelComponent<Dtype>();
@@ -25,6 +48,25 @@ TrainModel<Dtype>::TrainModel(bool has_valid, bool is_test){
 	_is_stop = false;
 	_has_valid = has_valid;
 	_is_test = is_test;
+	_load_layer = NULL;
+	_worker_idx = 0;
+	_comm = NULL;
+	_h_pars = NULL;
+	_num_pushed_layers = 0;
+	_pushed_len = 0;
+	_bucket_start = 0;
+	_is_shard = false;
+	_local_step = 1;
+	_num_local_update = 0;
+	_is_pars_thread_started = false;
+	_d_segments = NULL;
+	_optimizer = NULL;
+	_warmup_epoch = 0;
+	_num_stale_skip = 0;
+	_tensor_rank = 0;
+	_is_pars_stop = false;
+	pthread_mutex_init(&_pars_mutex, NULL);
+	pthread_cond_init(&_pars_cond, NULL);
 	if(has_valid)
 		_num_data_type = 2;
 	else
@@ -33,8 +75,26 @@ TrainModel<Dtype>::TrainModel(bool has_valid, bool is_test){
 
 template <typename Dtype>
 TrainModel<Dtype>::~TrainModel() {
+	if (_is_pars_thread_started) {
+		pthread_mutex_lock(&_pars_mutex);
+		_is_pars_stop = true;
+		pthread_cond_broadcast(&_pars_cond);
+		pthread_mutex_unlock(&_pars_mutex);
+		pthread_join(_pars_thread, NULL);
+	}
+	pthread_cond_destroy(&_pars_cond);
+	pthread_mutex_destroy(&_pars_mutex);
+	///> 副本的optimizer和参数版本号都是主模型的
+	if (_worker_idx == 0) {
+		delete _optimizer;
+		delete[] _model_component->_pars_version;
+	}
+	for (int t = 0; t < _model_component->_dE_dy_scratch.size(); ++t)
+		delete _model_component->_dE_dy_scratch[t];
 	delete _model_component;
 	delete _load_layer;
+	Engine::getInstance()->freeHost(_h_pars);
+	cudaFree(_d_segments);
 }
 
 template <typename Dtype>
@@ -44,7 +104,39 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 	ifstream fin(json_file.c_str());
 	if (reader.parse(fin, root)) {
 		_model_component->_minibatch_size = root["minibatch_size"].asInt();
-		Param::setMinibatchSize(_model_component->_minibatch_size);
+		if (!root["num_worker"].isNull())
+			_model_component->_num_worker = root["num_worker"].asInt();
+		_is_shard = root.get("shard_optimizer", false).asBool();
+		_local_step = root.get("local_sgd_step", 1).asInt();
+		if (_is_shard && _local_step > 1) {
+			cerr << "shard_optimizer can not be used with local_sgd_step." << endl;
+			exit(EXIT_FAILURE);
+		}
+		_model_component->_is_autotune = root.get("autotune", false).asBool();
+		_model_component->_is_fuse = root.get("fuse_layers", false).asBool();
+		///> 卷积算法的计时结果按形状和设备保存，以后运行直接使用
+		ConvAlgoCache::setFile(root.get("conv_algo_cache", "conv_algo.cache").asString());
+		_model_component->_is_hogwild = root.get("hogwild", false).asBool();
+		const int max_staleness = root.get("max_staleness", 0).asInt();
+		///> 流水线时num_worker是micro-batch的个数，每段layer由一个线程处理
+		const Json::Value &pipe = root["pipeline"];
+		if (!pipe.isNull()) {
+			_model_component->_num_stage = pipe.get("num_stage", 1).asInt();
+			_model_component->_pipeline_schedule = \
+				_model_component->_string_map_pipelineschedule[ \
+					pipe.get("schedule", "1F1B").asString()];
+		}
+		if (_model_component->isPipeline() && _model_component->_is_hogwild) {
+			cerr << "pipeline can not be used with hogwild." << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (!_model_component->_is_hogwild \
+				&& _model_component->_minibatch_size % _model_component->_num_worker != 0) {
+			cerr << "minibatch_size must be divisible by num_worker." << endl;
+			exit(EXIT_FAILURE);
+		}
+		///> 每一层只处理一个worker的那一段minibatch，hogwild时处理整个minibatch
+		Param::setMinibatchSize(_model_component->getWorkerMinibatchSize());
 
 		_model_component->_num_epoch = root["num_epoch"].asInt();
 		_model_component->_img_height = root["img_height"].asInt();
@@ -53,8 +145,63 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 
 		cout << "\n===========overall==============" \
 				<< "\nnum_epoch: " << _model_component->_num_epoch \
-				<< "\nbatchSize: " << _model_component->_minibatch_size;
-		
+				<< "\nbatchSize: " << _model_component->_minibatch_size \
+				<< "\nnum_worker: " << _model_component->_num_worker \
+				<< "\nshard_optimizer: " << _is_shard \
+				<< "\nlocal_sgd_step: " << _local_step \
+				<< "\nhogwild: " << _model_component->_is_hogwild \
+				<< "\nmax_staleness: " << max_staleness \
+				<< "\nnum_stage: " << _model_component->_num_stage;
+
+		///> 没有设置optimizer时使用带动量的sgd
+		OptimizerType optimizer_type = SGD;
+		const Json::Value &opt = root["optimizer"];
+		if (!opt.isNull())
+			optimizer_type = _model_component->_string_map_optimizertype[ \
+				opt["type"].asString()];
+		const float beta1 = opt.get("beta1", 0.9).asFloat();
+		const float beta2 = opt.get("beta2", 0.999).asFloat();
+		const float rho = opt.get("rho", 0.9).asFloat();
+		const float eps = opt.get("eps", 1e-8).asFloat();
+		const float eta = opt.get("eta", 0.001).asFloat();
+		_warmup_epoch = opt.get("warmup_epoch", 0).asInt();
+		///> 主机上的通信求和、缩放和读数据都交给这个线程池，0表示使用所有核
+		Engine::setNumThread(root.get("num_host_thread", 0).asInt());
+		///> numa拓扑，不给node_cpus时从/sys读取，node是-1时使用gpu所在的节点
+		const Json::Value &numa = root["numa"];
+		vector< vector<int> > node_cpus;
+		for (int i = 0; i < (int)numa["node_cpus"].size(); ++i) {
+			node_cpus.push_back(vector<int>());
+			for (int j = 0; j < (int)numa["node_cpus"][i].size(); ++j)
+				node_cpus[i].push_back(numa["node_cpus"][i][j].asInt());
+		}
+		Engine::setNuma(numa.get("pin_thread", false).asBool(), \
+				numa.get("node", -1).asInt(), node_cpus);
+		///> 主线程也是0号worker，之后分配的主机缓存由它和池线程第一次写
+		Engine::getInstance()->pinThread();
+		///> lars和lamb的范数缓存在optimizer里，不能被几个线程同时更新
+		if (_model_component->_is_hogwild \
+				&& (optimizer_type == LARS || optimizer_type == LAMB)) {
+			cerr << "hogwild can not be used with LARS or LAMB." << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (optimizer_type == NESTEROV)
+			_optimizer = new NesterovOptimizer();
+		else if (optimizer_type == ADAM)
+			_optimizer = new AdamOptimizer(beta1, beta2, eps);
+		else if (optimizer_type == ADAMW)
+			_optimizer = new AdamWOptimizer(beta1, beta2, eps);
+		else if (optimizer_type == RMSPROP)
+			_optimizer = new RMSPropOptimizer(rho, eps);
+		else if (optimizer_type == LARS)
+			_optimizer = new LarsOptimizer(eta);
+		else if (optimizer_type == LAMB)
+			_optimizer = new LambOptimizer(beta1, beta2, eps);
+		else
+			_optimizer = new SgdOptimizer();
+		_optimizer->setBF16State(opt.get("state_type", "FLOAT").asString() == "BF16");
+		_optimizer->printParam();
+		cout << "\nwarmup_epoch: " << _warmup_epoch;
 
 		_model_component->_num_layers = root["layer"].size();
 
@@ -65,7 +212,23 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 		string p_type;
 		Param* param;
 
+		///> 按top和bottom建立静态图，层按执行顺序创建，输入形状由产生它的层决定
+		NetGraph graph;
 		for (int i = 0; i < _model_component->_num_layers; ++i) {
+			vector<string> bottoms;
+			const Json::Value &bottom = root["layer"][i]["bottom"];
+			if (bottom.isString())
+				bottoms.push_back(bottom.asString());
+			for (int b = 0; bottom.isArray() && b < (int)bottom.size(); ++b)
+				bottoms.push_back(bottom[b].asString());
+			graph.addNode(root["layer"][i]["name"].asString(), \
+					root["layer"][i].get("top", "").asString(), bottoms);
+		}
+		graph.schedule();
+
+		for (int pos = 0; pos < _model_component->_num_layers; ++pos) {
+			const int i = graph.getNode(pos);
+			Param* in_shape = graph.getBottomShape(i, 0);
 			layer_type = root["layer"][i]["type"].asString();
 			name = root["layer"][i]["name"].asString();
 			if (!root["layer"][i]["filter_height"].isNull()) {
@@ -98,7 +261,7 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 				filter_channel = 0;
 			}
 			if (layer_type == "CONVOLUTION") {
-				if (_model_component->_layers_param.size() == 0) {
+				if (in_shape == NULL) {
 					param = new ConvParam( \
 							_model_component->_string_map_layertype[layer_type], \
 							name, w_lr, bias_lr, momentum, weight_decay, w_gauss, \
@@ -112,25 +275,49 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 							name, w_lr, bias_lr, momentum, weight_decay, w_gauss, \
 							pad_height, pad_width, stride_height, stride_width, \
 							filter_height, filter_width, filter_channel, \
-							dynamic_cast<LocalConnectParam*>( \
-								_model_component->_layers_param.back()));
+							dynamic_cast<LocalConnectParam*>(in_shape));
 				}
+				///> 不指定时创建层时计时选择
+				dynamic_cast<ConvParam*>(param)->setConvAlgo( \
+						_model_component->_string_map_convalgo[ \
+							root["layer"][i].get("conv_algo", "AUTO").asString()]);
 			} else if (layer_type == "POOLING") {
-				param = new PoolParam( \
-						_model_component->_string_map_layertype[layer_type], \
-						name, pad_height, pad_width, stride_height, stride_width, \
-						filter_height, filter_width, 0, \
-						dynamic_cast<LocalConnectParam*>( \
-							_model_component->_layers_param.at( \
-								_model_component->_layers_param.size() - 2)), \
-						_model_component->_string_map_pooltype[p_type]);
+				///> 输入是relu等逐点的层时，形状由它之前的卷积层给出
+				if (in_shape == NULL) {
+					param = new PoolParam( \
+							_model_component->_string_map_layertype[layer_type], \
+							name, _model_component->_img_height, \
+							_model_component->_img_width, pad_height, pad_width, \
+							stride_height, stride_width, _model_component->_img_channel, \
+							filter_height, filter_width, 0, \
+							_model_component->_string_map_pooltype[p_type]);
+				} else {
+					param = new PoolParam( \
+							_model_component->_string_map_layertype[layer_type], \
+							name, pad_height, pad_width, stride_height, stride_width, \
+							filter_height, filter_width, 0, \
+							dynamic_cast<LocalConnectParam*>(in_shape), \
+							_model_component->_string_map_pooltype[p_type]);
+				}
 			} else if (layer_type == "SIGMOID" || layer_type == "RECTIFIED" \
 					|| layer_type == "SOFTMAX" || layer_type == "DROPOUT") {
-				param = new FullConnectParam( \
-						_model_component->_string_map_layertype[layer_type], \
-						name, 0, _model_component->_layers_param.back());
+				if (in_shape == NULL) {
+					num_in = _model_component->_img_height * _model_component->_img_width \
+							 * _model_component->_img_channel;
+					param = new FullConnectParam( \
+							_model_component->_string_map_layertype[layer_type], \
+							name, num_in, num_in);
+				} else {
+					param = new FullConnectParam( \
+							_model_component->_string_map_layertype[layer_type], \
+							name, 0, in_shape);
+				}
+			} else if (layer_type == "ELTWISE_SUM") {
+				param = parseEltwiseParam(graph, i, name);
+			} else if (layer_type == "CONCAT") {
+				param = parseConcatParam(graph, i, name);
 			} else if (layer_type == "INNERPRODUCT" ) {
-				if (_model_component->_layers_param.size() == 0) {
+				if (in_shape == NULL) {
 					num_in = _model_component->_img_height \
 							 * _model_component->_img_width \
 							 * _model_component->_img_channel;
@@ -142,35 +329,152 @@ void TrainModel<Dtype>::parseNetJson(string json_file) {
 					param = new InnerParam( \
 							_model_component->_string_map_layertype[layer_type], \
 							name, w_lr, bias_lr, momentum, weight_decay, w_gauss, \
-							num_out, _model_component->_layers_param.back());
+							num_out, in_shape);
+				}
+				if (root["layer"][i].get("tensor_parallel", false).asBool()) {
+					dynamic_cast<InnerParam*>(param)->setTensorParallel(true);
+					_model_component->_is_tensor_parallel = true;
 				}
 			} else if(layer_type == "PREDICTOBJECT"){
 				param = new FullConnectParam( \
 						_model_component->_string_map_layertype[layer_type], \
-						name, 0, _model_component->_layers_param.back());
+						name, 0, in_shape);
 			} else if(layer_type == "RECOMMENDSUBSTITUE"){
 				param = new FullConnectParam( \
 						_model_component->_string_map_layertype[layer_type], \
-						name, num_out, _model_component->_layers_param.back());
+						name, num_out, in_shape);
 			} else if(layer_type == "RECOMMENDCOMPATIBLE"){
 				param = new FullConnectParam( \
 						_model_component->_string_map_layertype[layer_type], \
-						name, num_out, _model_component->_layers_param.back());
+						name, num_out, in_shape);
 			}
 			param->printParam();
 			_model_component->_layers_param.push_back(param);
 
+			///> 逐点的层输出形状和输入相同，后面的卷积和pooling可以直接使用
+			if (layer_type == "SIGMOID" || layer_type == "RECTIFIED" \
+					|| layer_type == "DROPOUT" || layer_type == "ELTWISE_SUM")
+				graph.setShapeParam(i, in_shape);
+			else
+				graph.setShapeParam(i, param);
+			vector<int> bottom_idx;
+			for (int b = 0; b < graph.getNumBottom(i); ++b)
+				bottom_idx.push_back(graph.getBottomIdx(i, b));
+			_model_component->_bottoms.push_back(bottom_idx);
+
 			if (param->getParamTrainType() == NEED) {
 				_model_component->_layers_need_train_param.push_back(param);
 				_model_component->_num_need_train_layers++;
+				_model_component->_max_staleness.push_back( \
+						root["layer"][i].get("max_staleness", max_staleness).asInt());
 			}
 		}
+
+		///> 一个tensor被几层使用时，反向最先算的(执行顺序最靠后的)一层直接写导数，
+		///> 其他层写到临时矩阵再累加
+		vector<int> last_consumer(_model_component->_num_layers + 1, -1);
+		for (int k = 0; k < _model_component->_num_layers; ++k)
+			for (int b = 0; b < _model_component->_bottoms[k].size(); ++b)
+				last_consumer[_model_component->_bottoms[k][b]] = k;
+		for (int k = 0; k < _model_component->_num_layers; ++k) {
+			_model_component->_is_direct_derivs.push_back(vector<bool>());
+			for (int b = 0; b < _model_component->_bottoms[k].size(); ++b)
+				_model_component->_is_direct_derivs[k].push_back( \
+						last_consumer[_model_component->_bottoms[k][b]] == k);
+		}
+		///> 流水线按层号切段，段之间只传一个tensor，要求是一条链
+		for (int k = 0; k < _model_component->_num_layers \
+				&& _model_component->isPipeline(); ++k) {
+			if (_model_component->_bottoms[k].size() != 1 \
+					|| _model_component->_bottoms[k][0] != k) {
+				cerr << "pipeline needs a linear net, layer " << k \
+					<< " does not take the output of layer " << k-1 << endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		///> 切分的层在前向和反向中做集合通信，只能有一个线程调用
+		if (_model_component->_is_tensor_parallel \
+				&& (_model_component->_num_worker > 1 || _model_component->isPipeline() \
+					|| _model_component->_is_hogwild || _is_shard || _local_step > 1)) {
+			cerr << "tensor_parallel can not be used with num_worker > 1, pipeline, " \
+				<< "hogwild, shard_optimizer or local_sgd_step." << endl;
+			exit(EXIT_FAILURE);
+		}
 	}
 	_model_component->_one_img_len = _model_component->_img_width \
 									 *_model_component->_img_height \
 									 *_model_component->_img_channel;
 }
 
+/// 第b个输入的channel、高和宽，全连接的输出看作高和宽为1
+template <typename Dtype>
+void TrainModel<Dtype>::getBottomDims(NetGraph& graph, const int i, const int b, \
+		int& channel, int& height, int& width){
+	Param* shape = graph.getBottomShape(i, b);
+	if (shape == NULL) {
+		channel = _model_component->_img_channel;
+		height = _model_component->_img_height;
+		width = _model_component->_img_width;
+	} else if (shape->getConnectType() == PARAM_CONNECT_TYPE_LOCAL) {
+		channel = shape->getOutChannel();
+		height = shape->getOutHeight();
+		width = shape->getOutWidth();
+	} else {
+		channel = shape->getNumOut();
+		height = 1;
+		width = 1;
+	}
+}
+
+/// 所有输入的长度必须相同，输出的形状和第一个输入相同
+template <typename Dtype>
+Param* TrainModel<Dtype>::parseEltwiseParam(NetGraph& graph, const int i, \
+		const string& name){
+	int channel, height, width;
+	getBottomDims(graph, i, 0, channel, height, width);
+	const int len = channel * height * width;
+	for (int b = 1; b < graph.getNumBottom(i); ++b) {
+		getBottomDims(graph, i, b, channel, height, width);
+		if (channel * height * width != len) {
+			cerr << "inputs of " << name << " have different sizes." << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	return new FullConnectParam(ELTWISE_SUM, name, len, len);
+}
+
+/// 所有输入的高和宽必须相同，按channel拼接
+template <typename Dtype>
+Param* TrainModel<Dtype>::parseConcatParam(NetGraph& graph, const int i, \
+		const string& name){
+	vector<int> channels;
+	int in_height, in_width;
+	for (int b = 0; b < graph.getNumBottom(i); ++b) {
+		int channel, height, width;
+		getBottomDims(graph, i, b, channel, height, width);
+		if (b > 0 && (height != in_height || width != in_width)) {
+			cerr << "inputs of " << name << " have different heights or widths." << endl;
+			exit(EXIT_FAILURE);
+		}
+		in_height = height;
+		in_width = width;
+		channels.push_back(channel);
+	}
+	return new ConcatParam(CONCAT, name, in_height, in_width, channels);
+}
+
+/// 需要在createLayer之前调用，标记了tensor_parallel的层按列切成num_process份
+template <typename Dtype>
+void TrainModel<Dtype>::setTensorParallel(const int rank, const int num_process){
+	_tensor_rank = rank;
+	for (int i = 0; i < _model_component->_num_layers; ++i) {
+		InnerParam *ip = dynamic_cast<InnerParam*>(_model_component->_layers_param[i]);
+		if (ip != NULL && ip->isTensorParallel())
+			ip->setShard(rank, num_process);
+	}
+}
+
 template <typename Dtype>
 void TrainModel<Dtype>::createLayer(){
 	cout << _model_component->_num_layers << endl;
@@ -188,7 +492,18 @@ void TrainModel<Dtype>::createLayer(){
 			} else if (param->getLayerType() == SIGMOID) {
 				layer = new SigmoidLayer<Dtype>(dynamic_cast<FullConnectParam*>(param));
 			} else if (param->getLayerType() == RECTIFIED) {
-				layer = new ReluLayer<Dtype>(dynamic_cast<FullConnectParam*>(param));
+				ReluLayer<Dtype>* relu = new ReluLayer<Dtype>( \
+						dynamic_cast<FullConnectParam*>(param));
+				if (_model_component->_is_fuse && isFusibleRelu(i)) {
+					Layer<Dtype>* conv = _model_component->_layers[ \
+						_model_component->_bottoms[i][0]-1];
+					dynamic_cast<ConvNet<Dtype>*>(conv)->setFuseRelu(true);
+					relu->fuseInto(conv);
+					cout << "fuse " << param->getName() << " into " \
+						<< _model_component->_layers_param[ \
+						_model_component->_bottoms[i][0]-1]->getName() << endl;
+				}
+				layer = relu;
 			} else if (param->getLayerType() == SOFTMAX) {
 				layer = new Logistic<Dtype>(dynamic_cast<FullConnectParam*>(param));
 			} else if (param->getLayerType() == DROPOUT) {
@@ -196,6 +511,10 @@ void TrainModel<Dtype>::createLayer(){
 			} else if (param->getLayerType() == INNERPRODUCT ) {
 				FullConnectParam* fcp = dynamic_cast<FullConnectParam*>(param);
 				layer = new InnerProductLayer<Dtype>(dynamic_cast<InnerParam*>(fcp));
+			} else if (param->getLayerType() == ELTWISE_SUM) {
+				layer = new EltwiseSumLayer<Dtype>(param);
+			} else if (param->getLayerType() == CONCAT) {
+				layer = new ConcatLayer<Dtype>(dynamic_cast<ConcatParam*>(param));
 			}
 		}catch(int e){
 			cout << "dynamic point is null\n";
@@ -203,23 +522,142 @@ void TrainModel<Dtype>::createLayer(){
 
 		layer->initCuda();
 		_model_component->_layers.push_back(layer);
+		///> 进程号在setCommunicator时再加进去
+		if (param->getLayerType() == DROPOUT)
+			dynamic_cast<DropoutLayer<Dtype>*>(layer)->setSeed(i, _worker_idx, 0);
+		///> 副本的层参数已经有主模型的结果，不再重新测
+		if (_model_component->_is_autotune && !param->isTuned())
+			autotuneLayer(i);
 
 		if (param->getParamTrainType() == NEED) {
 			_model_component->_layers_needed_train.push_back(layer);
+			_train_layer_idx.push_back(i);
 		}
 	}
 }
 
+/// 第i层的输入是卷积的输出，而且只有这一层使用。卷积的前向写入relu以后的值，
+/// 它的输出不再需要单独保存一份，relu层前向不再读写整个tensor
 template <typename Dtype>
-void TrainModel<Dtype>::createWBias() {
-	for (int i = 0; i < _model_component->getNumNeedTrainLayers(); ++i) {
+bool TrainModel<Dtype>::isFusibleRelu(const int i){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int t = mc->_bottoms[i][0];
+	if (t == 0 || mc->_layers_param[t-1]->getLayerType() != CONVOLUTION)
+		return false;
+	for (int k = 0; k < mc->_num_layers; ++k)
+		for (int b = 0; b < mc->_bottoms[k].size(); ++b)
+			if (k != i && mc->_bottoms[k][b] == t)
+				return false;
+	return true;
+}
+
+/// 输入和输入导数用临时的矩阵，前向和反向分别选择，输入是数据的层不计算输入导数。
+/// 小层的kernel启动开销占主要部分，大层需要更多的block和线程，各层结果不同
+template <typename Dtype>
+void TrainModel<Dtype>::autotuneLayer(const int i){
+	ModelComponent<Dtype> *mc = _model_component;
+	Layer<Dtype> *layer = mc->_layers[i];
+	Param *param = mc->_layers_param[i];
+	const int num_forward = layer->getNumForwardConfig();
+	const int num_backward = mc->_bottoms[i][0] > 0 ? layer->getNumBackwardConfig() : 0;
+	if (num_forward == 0 && num_backward == 0)
+		return;
+
+	const int bottom = mc->_bottoms[i][0];
+	const int in_len = bottom == 0 ? mc->_one_img_len \
+					   : mc->_layers[bottom-1]->getY()->getNumCols();
+	Matrix<Dtype> *x = new Matrix<Dtype>(layer->getY()->getNumRows(), in_len);
+	Matrix<Dtype> *dE_dx = new Matrix<Dtype>(x);
+	x->zeros();
+	layer->getDEDY()->zeros();
+
+	int best_forward = 0;
+	float forward_time = 0;
+	for (int c = 0; c < num_forward; ++c) {
+		layer->setForwardConfig(c);
+		const float t = layer->timeComputation(x, NULL);
+		if (c == 0 || t < forward_time) {
+			best_forward = c;
+			forward_time = t;
+		}
+	}
+	if (num_forward > 0)
+		layer->setForwardConfig(best_forward);
+
+	int best_backward = 0;
+	float backward_time = 0;
+	for (int c = 0; c < num_backward; ++c) {
+		layer->setBackwardConfig(c);
+		const float t = layer->timeComputation(x, dE_dx);
+		if (c == 0 || t < backward_time) {
+			best_backward = c;
+			backward_time = t;
+		}
+	}
+	if (num_backward > 0)
+		layer->setBackwardConfig(best_backward);
+
+	param->setTunedConfig(best_forward, best_backward);
+	cout << param->getName() << " autotune: forward config " << best_forward \
+		<< "/" << num_forward << " " << forward_time << "ms, backward config " \
+		<< best_backward << "/" << num_backward << " " << backward_time << "ms" << endl;
+
+	delete x;
+	delete dE_dx;
+}
+
+/// 把所有需要训练层的参数和导数放进两段连续的显存，各层改为使用其中的一段，
+/// optimizer按同样的布局分配自己的状态。
+/// master不为空时是数据并行的副本，参数使用master的，只有导数是自己的，不需要状态
+template <typename Dtype>
+void TrainModel<Dtype>::createWBias(TrainModel<Dtype>* master) {
+	ModelComponent<Dtype> *mc = _model_component;
+	const int num_train = mc->_num_need_train_layers;
+
+	mc->_w_offset.resize(num_train);
+	mc->_bias_offset.resize(num_train);
+	int len = 0;
+	for (int k = num_train - 1; k >= 0; --k) {
 		TrainLayer<Dtype>* tl = dynamic_cast<TrainLayer<Dtype>*>( \
-				_model_component->_layers_needed_train[i]);
-		_model_component->_w.push_back(tl->getW());
-		_model_component->_bias.push_back(tl->getBias());
-		_model_component->_w_len.push_back(tl->getW()->getNumEles());
-		_model_component->_bias_len.push_back(tl->getBias()->getNumEles());
+				mc->_layers_needed_train[k]);
+		mc->_w_offset[k] = len;
+		len += DIVUP(tl->getW()->getNumEles(), PARS_ALIGN) * PARS_ALIGN;
+		mc->_bias_offset[k] = len;
+		len += DIVUP(tl->getBias()->getNumEles(), PARS_ALIGN) * PARS_ALIGN;
+	}
+	mc->_pars_len = len;
+
+	if (master == NULL) {
+		mc->_pars = new Matrix<Dtype>(1, len);
+		mc->_pars->zeros();
+		_optimizer->createState(len);
+		if (mc->_is_hogwild)
+			mc->_pars_version = new int[num_train]();
+	} else {
+		mc->_pars = new Matrix<Dtype>( \
+				master->_model_component->_pars->getDevData(), 1, len);
 	}
+	mc->_derivs = new Matrix<Dtype>(1, len);
+	mc->_derivs->zeros();
+
+	for (int k = 0; k < num_train; ++k) {
+		TrainLayer<Dtype>* tl = dynamic_cast<TrainLayer<Dtype>*>( \
+				mc->_layers_needed_train[k]);
+		tl->bindPars(mc->_pars->getDevData() + mc->_w_offset[k], \
+				mc->_pars->getDevData() + mc->_bias_offset[k], \
+				mc->_derivs->getDevData() + mc->_w_offset[k], \
+				mc->_derivs->getDevData() + mc->_bias_offset[k]);
+
+		mc->_w.push_back(tl->getW());
+		mc->_bias.push_back(tl->getBias());
+		mc->_w_len.push_back(tl->getW()->getNumEles());
+		mc->_bias_len.push_back(tl->getBias()->getNumEles());
+		mc->_dE_dw.push_back(tl->getDEDW());
+		mc->_dE_db.push_back(tl->getDEDB());
+	}
+
+	_segments.resize(2 * num_train);
+	cudaMalloc((void**)&_d_segments, sizeof(ParsSegment) * 2 * num_train);
 }
 
 template <typename Dtype>
@@ -234,16 +672,72 @@ void TrainModel<Dtype>::createYDEDY() {
 		if (_model_component->_layers_param[i]->getParamTrainType() == NEED \
 				&& i > 0) {
 			///> 为了反向对weight和bias求导时要用到
-			_model_component->_y_needed_train.push_back( \
-					_model_component->_layers[i-1]->getY());
+			const int bottom = _model_component->_bottoms[i][0];
+			_model_component->_y_needed_train.push_back(bottom == 0 \
+					? _model_component->_mini_data \
+					: _model_component->_layers[bottom-1]->getY());
+		}
+	}
+
+	///> 被几层使用的tensor，除了直接写导数的一层都先写到临时矩阵
+	_model_component->_dE_dy_scratch.assign(_model_component->_num_layers + 1, NULL);
+	for (int k = 0; k < _model_component->_num_layers; ++k) {
+		for (int b = 0; b < _model_component->_bottoms[k].size(); ++b) {
+			const int t = _model_component->_bottoms[k][b];
+			if (t > 0 && !_model_component->_is_direct_derivs[k][b] \
+					&& _model_component->_dE_dy_scratch[t] == NULL)
+				_model_component->_dE_dy_scratch[t] = new Matrix<Dtype>( \
+						_model_component->_dE_dy[t-1]);
 		}
 	}
 }
 
+/// 第k层的前向，输入是_bottoms[k]中的tensor
+template <typename Dtype>
+void TrainModel<Dtype>::forwardLayer(const int k){
+	ModelComponent<Dtype> *mc = _model_component;
+	if (mc->_bottoms[k].size() == 1) {
+		mc->_layers[k]->computeOutput(mc->_y[mc->_bottoms[k][0]]);
+		return;
+	}
+	vector<Matrix<Dtype>*> xs;
+	for (int b = 0; b < mc->_bottoms[k].size(); ++b)
+		xs.push_back(mc->_y[mc->_bottoms[k][b]]);
+	mc->_layers[k]->computeMultiOutput(xs);
+}
+
+/// 第k层的输入导数，输入是数据时不计算，不是直接写的导数算完以后累加
+template <typename Dtype>
+void TrainModel<Dtype>::backwardLayer(const int k){
+	ModelComponent<Dtype> *mc = _model_component;
+	vector<Matrix<Dtype>*> dE_dxs;
+	bool has_derivs = false;
+	for (int b = 0; b < mc->_bottoms[k].size(); ++b) {
+		const int t = mc->_bottoms[k][b];
+		if (t == 0)
+			dE_dxs.push_back(NULL);
+		else if (mc->_is_direct_derivs[k][b])
+			dE_dxs.push_back(mc->_dE_dy[t-1]);
+		else
+			dE_dxs.push_back(mc->_dE_dy_scratch[t]);
+		has_derivs = has_derivs || t > 0;
+	}
+	if (!has_derivs)
+		return;
+
+	mc->_layers[k]->computeMultiDerivsOfInput(dE_dxs);
+	for (int b = 0; b < mc->_bottoms[k].size(); ++b) {
+		const int t = mc->_bottoms[k][b];
+		if (t > 0 && !mc->_is_direct_derivs[k][b])
+			mc->_dE_dy[t-1]->add(mc->_dE_dy_scratch[t], 1, 1);
+	}
+}
+
 template <typename Dtype>
 void TrainModel<Dtype>::initWeightByRandom() {
 	
-	srand((unsigned)time(NULL)); 
+	///> 切分的层每个进程保存不同的列，种子不同，不切分的层之后从0号进程广播
+	srand((unsigned)time(NULL) + _tensor_rank); 
 	for (int k = 0; k < _model_component->_num_need_train_layers; ++k) {
 		gaussRand(_model_component->_w[k], \
 					dynamic_cast<TrainParam*>( \
@@ -264,28 +758,448 @@ void TrainModel<Dtype>::initWeightByFile(vector<string> w_file, \
 
 template <typename Dtype>
 void TrainModel<Dtype>::forwardPropagate(){
-	for (int k = 0; k < _model_component->_num_layers-1; ++k) {
-		_model_component->_layers[k]->computeOutput(\
-				_model_component->_y[k]);
+	///> hogwild时记下前向用的参数版本，更新时和当前版本比较得到延迟
+	if (_model_component->_is_hogwild) {
+		_read_version.resize(_model_component->_num_need_train_layers);
+		for (int k = 0; k < _model_component->_num_need_train_layers; ++k)
+			_read_version[k] = _model_component->_pars_version[k];
 	}
+	for (int k = 0; k < _model_component->_num_layers-1; ++k)
+		forwardLayer(k);
 }
 
+/// 第begin到end-1层的前向，最后一层由forwardLastLayer计算
+template <typename Dtype>
+void TrainModel<Dtype>::forwardLayers(const int begin, const int end){
+	for (int k = begin; k < end && k < _model_component->_num_layers-1; ++k)
+		forwardLayer(k);
+}
+
+/// 第end-1到begin层的反向，参数导数和输入导数都在调用线程上计算，
+/// 最后一层的输入导数由backwardLastLayer计算
+template <typename Dtype>
+void TrainModel<Dtype>::backwardLayers(const int begin, const int end){
+	ModelComponent<Dtype> *mc = _model_component;
+	int j = mc->_num_need_train_layers-1;
+	for (int k = min(end, mc->_num_layers-1) - 1; k >= begin; --k) {
+		while (j >= 0 && _train_layer_idx[j] > k)
+			j--;
+		if (j >= 0 && _train_layer_idx[j] == k) {
+			TrainLayer<Dtype> *tl = dynamic_cast< TrainLayer<Dtype>* >( \
+					mc->_layers_needed_train[j]);
+			tl->computeDerivsOfPars(mc->_y_needed_train[j]);
+		}
+		backwardLayer(k);
+	}
+}
+
+/// 从上往下计算输入导数，某一层的dE_dy算好以后就交给参数线程计算它的参数导数，
+/// 同时本线程继续计算下面层的输入导数。返回时所有参数导数都已算完
 template <typename Dtype>
 void TrainModel<Dtype>::backwardPropagate(){
-	for (int k = _model_component->_num_layers-2; k > 0; --k) {
-		_model_component->_layers[k]->computeDerivsOfInput( \
-				_model_component->_dE_dy[k-1]);
+	if (!_is_pars_thread_started) {
+		pthread_create(&_pars_thread, NULL, runParsThread, this);
+		_is_pars_thread_started = true;
 	}
+
+	pthread_mutex_lock(&_pars_mutex);
+	_num_pars_done = 0;
+	_input_done_idx = _model_component->_num_layers-1;
+	pthread_mutex_unlock(&_pars_mutex);
+
+	int j = _model_component->_num_need_train_layers-1;
+	for (int k = _model_component->_num_layers-2; k >= 0; --k) {
+		if (j >= 0 && _train_layer_idx[j] == k) {
+			pthread_mutex_lock(&_pars_mutex);
+			_pars_queue.push_back(j);
+			pthread_cond_broadcast(&_pars_cond);
+			pthread_mutex_unlock(&_pars_mutex);
+			j--;
+		}
+		backwardLayer(k);
+		pthread_mutex_lock(&_pars_mutex);
+		_input_done_idx = k;
+		pthread_cond_broadcast(&_pars_cond);
+		pthread_mutex_unlock(&_pars_mutex);
+	}
+
+	pthread_mutex_lock(&_pars_mutex);
+	while (_num_pars_done < _model_component->_num_need_train_layers)
+		pthread_cond_wait(&_pars_cond, &_pars_mutex);
+	pthread_mutex_unlock(&_pars_mutex);
 }
 
 template <typename Dtype>
-void TrainModel<Dtype>::computeAndUpdatePars(){
-	for (int k = _model_component->_num_need_train_layers-1; k >= 0; --k) {
+void* TrainModel<Dtype>::runParsThread(void* model){
+	Engine::getInstance()->pinThread();
+	static_cast<TrainModel<Dtype>* >(model)->computeParsLoop();
+	return NULL;
+}
+
+/// 参数线程按层从上到下的顺序计算参数导数，顺序和进程间通信的bucket一致
+template <typename Dtype>
+void TrainModel<Dtype>::computeParsLoop(){
+	pthread_mutex_lock(&_pars_mutex);
+	while (true) {
+		while (_pars_queue.empty() && !_is_pars_stop)
+			pthread_cond_wait(&_pars_cond, &_pars_mutex);
+		if (_pars_queue.empty())
+			break;
+		const int k = _pars_queue.front();
+		_pars_queue.pop_front();
+		pthread_mutex_unlock(&_pars_mutex);
+
 		TrainLayer<Dtype> *tl = dynamic_cast< TrainLayer<Dtype>* >( \
 				_model_component->_layers_needed_train[k]);
 		tl->computeDerivsOfPars(_model_component->_y_needed_train[k]);
-		tl->updatePars();
+		///> 只有一个worker时不需要进程内求平均，算完一层就可以开始通信
+		if (_comm != NULL && _workers.size() == 1 && !isShardUpdate() \
+				&& !isLocalSGD() && !isTensorParallel())
+			pushDerivsOfPars(k);
+
+		if (isUpdateInBackward()) {
+			pthread_mutex_lock(&_pars_mutex);
+			while (_input_done_idx > _train_layer_idx[k])
+				pthread_cond_wait(&_pars_cond, &_pars_mutex);
+			pthread_mutex_unlock(&_pars_mutex);
+			///> hogwild时参数版本号在fillSegments里加1
+			if (isFresh(k))
+				updateLayerPars(k, 1);
+			else
+				_num_stale_skip++;
+		}
+
+		pthread_mutex_lock(&_pars_mutex);
+		_num_pars_done++;
+		pthread_cond_broadcast(&_pars_cond);
+	}
+	pthread_mutex_unlock(&_pars_mutex);
+}
+
+/// 连续存放的导数平均分成num_worker段，每个worker把所有副本中自己那一段
+/// 取平均，写进0号worker的导数，0号worker用它更新全部参数。
+/// 调用前所有worker都要算完导数
+template <typename Dtype>
+void TrainModel<Dtype>::reduceDerivsOfPars(){
+	const int num_worker = _workers.size();
+	if (num_worker == 1)
+		return;
+
+	const int chunk = DIVUP(_model_component->_pars_len, num_worker * PARS_ALIGN) \
+					  * PARS_ALIGN;
+	const int start = _worker_idx * chunk;
+	const int len = min(start + chunk, _model_component->_pars_len) - start;
+	if (len <= 0)
+		return;
+
+	Dtype *derivs = _workers[0]->_model_component->_derivs->getDevData() + start;
+	const int num_block = min(DIVUP(len / 4, UPDATE_BLOCK_SIZE), MAX_NUM_KERNEL);
+	for (int i = 1; i < num_worker; ++i) {
+		axpby<<<num_block, UPDATE_BLOCK_SIZE>>>(derivs, \
+				_workers[i]->_model_component->_derivs->getDevData() + start, \
+				1, 1, len);
+	}
+	///> 学习率按每个worker的minibatch归一化，这里取平均保持步长不变
+	axpby<<<num_block, UPDATE_BLOCK_SIZE>>>(derivs, derivs, \
+			1.0f / num_worker, 0, len);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+/// 按导数算完的顺序(从最后一层往前)把第k层导数放进_h_pars，攒够一个bucket
+/// 就交给后台线程做allreduce，和剩下的层的计算重叠。连续空间也是这个顺序，
+/// 所以一层的w和bias是一段，_h_pars和_derivs的下标一一对应
+template <typename Dtype>
+void TrainModel<Dtype>::pushDerivsOfPars(const int k){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int end = k == 0 ? mc->_pars_len : mc->_w_offset[k-1];
+	cudaMemcpy(_h_pars + _pushed_len, mc->_derivs->getDevData() + _pushed_len, \
+			sizeof(Dtype) * (end - _pushed_len), cudaMemcpyDeviceToHost);
+	_pushed_len = end;
+	_num_pushed_layers++;
+
+	if (_pushed_len - _bucket_start >= BUCKET_SIZE) {
+		_comm->allReduceAsync(_h_pars + _bucket_start, _pushed_len - _bucket_start);
+		_bucket_start = _pushed_len;
+	}
+}
+
+/// 由0号worker调用，这时本进程的导数已经在各个worker上求过平均，
+/// 把还没有提交的层提交，等所有bucket通信完以后在进程间求平均
+template <typename Dtype>
+void TrainModel<Dtype>::allReduceDerivsOfPars(){
+	if (_comm == NULL || _comm->getNumProcess() == 1 || isLocalSGD() \
+			|| isTensorParallel())
+		return;
+	if (isShardUpdate()) {
+		reduceScatterDerivsOfPars();
+		return;
+	}
+
+	ModelComponent<Dtype> *mc = _model_component;
+	for (int k = mc->_num_need_train_layers - 1 - _num_pushed_layers; k >= 0; --k)
+		pushDerivsOfPars(k);
+	if (_pushed_len > _bucket_start)
+		_comm->allReduceAsync(_h_pars + _bucket_start, _pushed_len - _bucket_start);
+	_comm->waitAll();
+
+	scaleHost(_h_pars, 0, mc->_pars_len, 1.0f / _comm->getNumProcess());
+	mc->_derivs->copyFromHost(_h_pars, mc->_pars_len);
+
+	_num_pushed_layers = 0;
+	_pushed_len = 0;
+	_bucket_start = 0;
+}
+
+/// 第k层在连续空间中的段号是2*(num_train-1-k)，段号越大层越靠前。
+/// 每次更新前填写，学习率可能被warmup改过
+template <typename Dtype>
+int TrainModel<Dtype>::fillSegments(const int k, const int num_layer){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int num_train = mc->_num_need_train_layers;
+
+	int max_len = 0;
+	for (int j = k; j < k + num_layer; ++j) {
+		TrainLayer<Dtype> *tl = dynamic_cast< TrainLayer<Dtype>* >( \
+				mc->_layers_needed_train[j]);
+		TrainParam *tp = tl->getTrainParam();
+		ParsSegment &w_seg = _segments[2 * (num_train - 1 - j)];
+		ParsSegment &bias_seg = _segments[2 * (num_train - 1 - j) + 1];
+		///> hogwild时每个副本只能数到自己的更新，adam的偏差修正要用所有副本
+		///> 一共更新的次数，即共享的参数版本号
+		const int step = mc->_is_hogwild \
+						 ? __sync_add_and_fetch(&mc->_pars_version[j], 1) \
+						 : w_seg.step + 1;
+
+		w_seg.start = mc->_w_offset[j];
+		w_seg.len = mc->_bias_offset[j] - mc->_w_offset[j];
+		w_seg.lr = tp->getWLR();
+		w_seg.grad_scale = 1.0f / tp->getMinibatchSize();
+		w_seg.momentum = tp->getMomentum();
+		w_seg.weight_decay = tp->getWeightDecay();
+		w_seg.decay_coef = tp->getDecayCoef();
+		w_seg.step = step;
+		w_seg.is_bias = 0;
+
+		bias_seg.start = mc->_bias_offset[j];
+		bias_seg.len = (j == 0 ? mc->_pars_len : mc->_w_offset[j-1]) \
+					   - mc->_bias_offset[j];
+		bias_seg.lr = tp->getBiasLR();
+		bias_seg.grad_scale = 1.0f / tp->getMinibatchSize();
+		bias_seg.momentum = tp->getMomentum();
+		bias_seg.weight_decay = 0;
+		bias_seg.decay_coef = 0;
+		bias_seg.step = step;
+		bias_seg.is_bias = 1;
+
+		max_len = max(max_len, max(w_seg.len, bias_seg.len));
+	}
+	return max_len;
+}
+
+/// 一次kernel更新第k层开始的num_layer层，这些层的段号是连续的
+template <typename Dtype>
+void TrainModel<Dtype>::updateLayerPars(const int k, const int num_layer){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int first_seg = 2 * (mc->_num_need_train_layers - k - num_layer);
+	const int num_seg = 2 * num_layer;
+
+	const int max_len = fillSegments(k, num_layer);
+	cudaMemcpy(_d_segments + first_seg, &_segments[first_seg], \
+			sizeof(ParsSegment) * num_seg, cudaMemcpyHostToDevice);
+
+	_optimizer->update(mc->_pars->getDevData(), mc->_derivs->getDevData(), \
+			_d_segments + first_seg, num_seg, max_len);
+	cudaStreamSynchronize(cudaStreamPerThread);
+	cudaCheckError();
+}
+
+/// 所有参数共享一份，由0号worker用一次kernel全部更新
+template <typename Dtype>
+void TrainModel<Dtype>::updatePars(){
+	if (isUpdateInBackward() || _worker_idx != 0)
+		return;
+
+	if (isShardUpdate())
+		updateShardPars();
+	else
+		updateLayerPars(0, _model_component->_num_need_train_layers);
+
+	if (isLocalSGD() && ++_num_local_update % _local_step == 0)
+		averagePars();
+}
+
+/// 分片时每个进程只需要自己那几段的平均导数
+template <typename Dtype>
+void TrainModel<Dtype>::reduceScatterDerivsOfPars(){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int rank = _comm->getRank();
+	const int start = _shard_starts[rank];
+	const int len = _shard_starts[rank + 1] - start;
+
+	mc->_derivs->copyToHost(_h_pars, mc->_pars_len);
+	_comm->reduceScatter(_h_pars, _shard_starts);
+
+	scaleHost(_h_pars, start, start + len, 1.0f / _comm->getNumProcess());
+	cudaMemcpy(mc->_derivs->getDevData() + start, _h_pars + start, \
+			sizeof(Dtype) * len, cudaMemcpyHostToDevice);
+}
+
+/// 只更新本进程的几段，optimizer的状态只有这几段那么长，
+/// 所以段的起点都减去分片的起点，参数和导数也从分片的起点开始传
+template <typename Dtype>
+void TrainModel<Dtype>::updateShardPars(){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int rank = _comm->getRank();
+	const int first_seg = _shard_segs[rank];
+	const int num_seg = _shard_segs[rank + 1] - first_seg;
+	const int start = _shard_starts[rank];
+
+	fillSegments(0, mc->_num_need_train_layers);
+	if (num_seg > 0) {
+		vector<ParsSegment> shard(_segments.begin() + first_seg, \
+				_segments.begin() + first_seg + num_seg);
+		int max_len = 0;
+		for (int i = 0; i < num_seg; ++i) {
+			shard[i].start -= start;
+			max_len = max(max_len, shard[i].len);
+		}
+		cudaMemcpy(_d_segments + first_seg, &shard[0], \
+				sizeof(ParsSegment) * num_seg, cudaMemcpyHostToDevice);
+
+		_optimizer->update(mc->_pars->getDevData() + start, \
+				mc->_derivs->getDevData() + start, _d_segments + first_seg, \
+				num_seg, max_len);
+		cudaStreamSynchronize(cudaStreamPerThread);
+		cudaCheckError();
+	}
+
+	allGatherPars();
+}
+
+/// 每个进程把自己更新的那几段参数发给其他进程
+template <typename Dtype>
+void TrainModel<Dtype>::allGatherPars(){
+	ModelComponent<Dtype> *mc = _model_component;
+	const int rank = _comm->getRank();
+	const int start = _shard_starts[rank];
+
+	cudaMemcpy(_h_pars + start, mc->_pars->getDevData() + start, \
+			sizeof(Dtype) * (_shard_starts[rank + 1] - start), cudaMemcpyDeviceToHost);
+	_comm->allGather(_h_pars, _shard_starts);
+	mc->_pars->copyFromHost(_h_pars, mc->_pars_len);
+}
+
+/// local sgd时每_local_step次更新调用一次，所有进程的参数取平均，
+/// 通信量是每步传导数的1/_local_step，optimizer的状态各自保留
+template <typename Dtype>
+void TrainModel<Dtype>::averagePars(){
+	ModelComponent<Dtype> *mc = _model_component;
+	mc->_pars->copyToHost(_h_pars, mc->_pars_len);
+	_comm->allReduce(_h_pars, mc->_pars_len);
+
+	scaleHost(_h_pars, 0, mc->_pars_len, 1.0f / _comm->getNumProcess());
+	mc->_pars->copyFromHost(_h_pars, mc->_pars_len);
+}
+
+/// 前_warmup_epoch个epoch的学习率从设定值的1/_warmup_epoch线性增加到设定值，
+/// 每个epoch开始时由0号worker调用，第epoch_idx个epoch是设定值的(epoch_idx+1)/_warmup_epoch
+template <typename Dtype>
+void TrainModel<Dtype>::warmupLR(const int epoch_idx){
+	if (epoch_idx >= _warmup_epoch)
+		return;
+
+	const float lr_scale = epoch_idx == 0 ? 1.0f / _warmup_epoch \
+						   : (epoch_idx + 1.0f) / epoch_idx;
+	for (int k = 0; k < _model_component->_num_need_train_layers; ++k)
+		dynamic_cast<TrainParam*>(_model_component->_layers_need_train_param[k]) \
+			->lrMultiScale(lr_scale);
+}
+
+/// 需要在createWBias和createWorkers之后调用。分片时按段把参数尽量平均地分给每个进程，
+/// 一段不拆开，这样lars/lamb每段的范数在一个进程里就能算出来
+template <typename Dtype>
+void TrainModel<Dtype>::setCommunicator(Communicator* comm){
+	ModelComponent<Dtype> *mc = _model_component;
+	if (mc->_is_hogwild && comm->getNumProcess() > 1) {
+		cerr << "hogwild can not be used with multiple processes." << endl;
+		exit(EXIT_FAILURE);
+	}
+	_comm = comm;
+	Engine::getInstance()->freeHost(_h_pars);
+	_h_pars = static_cast<Dtype*>(Engine::getInstance()->allocHost( \
+				sizeof(Dtype) * mc->_pars_len));
+	///> 按列切分的全连接层在层内拼接输出、累加输入导数
+	for (int i = 0; i < mc->_num_layers; ++i) {
+		InnerProductLayer<Dtype> *ipl = \
+			dynamic_cast<InnerProductLayer<Dtype>*>(mc->_layers[i]);
+		if (ipl != NULL)
+			ipl->setCommunicator(comm);
+	}
+	///> 各进程的dropout使用不同的key，按列切分时所有进程处理相同的数据，
+	///> 激活值在进程间是相同的，mask也必须相同
+	const int seed_rank = mc->_is_tensor_parallel ? 0 : comm->getRank();
+	vector< TrainModel<Dtype>* > models = _workers;
+	if (models.empty())
+		models.push_back(this);
+	for (int w = 0; w < models.size(); ++w) {
+		TrainModel<Dtype> *worker = models[w];
+		for (int i = 0; i < mc->_num_layers; ++i) {
+			DropoutLayer<Dtype> *dl = dynamic_cast<DropoutLayer<Dtype>*>( \
+					worker->_model_component->_layers[i]);
+			if (dl != NULL)
+				dl->setSeed(i, worker->_worker_idx, seed_rank);
+		}
+	}
+
+	if (!isShardUpdate())
+		return;
+
+	const int num_process = _comm->getNumProcess();
+	const int num_seg = 2 * mc->_num_need_train_layers;
+	vector<int> seg_starts(num_seg + 1);
+	for (int j = 0; j < mc->_num_need_train_layers; ++j) {
+		seg_starts[2 * (mc->_num_need_train_layers - 1 - j)] = mc->_w_offset[j];
+		seg_starts[2 * (mc->_num_need_train_layers - 1 - j) + 1] = mc->_bias_offset[j];
+	}
+	seg_starts[num_seg] = mc->_pars_len;
+
+	_shard_segs.resize(num_process + 1);
+	_shard_starts.resize(num_process + 1);
+	int seg = 0;
+	for (int r = 0; r <= num_process; ++r) {
+		const long long target = (long long)mc->_pars_len * r / num_process;
+		while (seg < num_seg && seg_starts[seg] < target)
+			seg++;
+		_shard_segs[r] = seg;
+		_shard_starts[r] = seg_starts[seg];
+	}
+
+	const int rank = _comm->getRank();
+	_optimizer->createState(_shard_starts[rank + 1] - _shard_starts[rank]);
+}
+
+/// 所有进程从0号进程的初始权重开始训练
+template <typename Dtype>
+void TrainModel<Dtype>::broadcastPars(){
+	if (_comm == NULL || _comm->getNumProcess() == 1)
+		return;
+
+	ModelComponent<Dtype> *mc = _model_component;
+	mc->_pars->copyToHost(_h_pars, mc->_pars_len);
+	if (isTensorParallel()) {
+		///> 切分的层各进程的列不同，只广播其他层，每段的长度在各进程相同
+		for (int k = 0; k < mc->_num_need_train_layers; ++k) {
+			InnerParam *ip = dynamic_cast<InnerParam*>(mc->_layers_need_train_param[k]);
+			if (ip != NULL && ip->getNumShard() > 1)
+				continue;
+			_comm->broadcast(_h_pars + mc->_w_offset[k], mc->_w_len[k]);
+			_comm->broadcast(_h_pars + mc->_bias_offset[k], mc->_bias_len[k]);
+		}
+	} else {
+		_comm->broadcast(_h_pars, mc->_pars_len);
 	}
+	mc->_pars->copyFromHost(_h_pars, mc->_pars_len);
 }
 
 template <typename Dtype>
@@ -0,0 +1,90 @@
+///
+/// \file test_weight_decay.cu
+/// \brief 学习率改变时weight decay的系数不变，除sgd和nesterov以外，
+/// 从相同的状态走一步，参数的变化量和学习率成正比
+///
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include "optimizer.hpp"
+
+using namespace std;
+
+int Param::_minibatch_size = 0;
+
+#define SEG_LEN 64
+#define INIT_LR 0.1f
+#define DECAY_COEF 0.01f
+
+/// 用学习率lr更新一段w，weight_decay和实际训练时一样是按初始学习率算的
+static void updateOnce(Optimizer* optimizer, const float lr, vector<float>& delta) {
+	vector<float> h_w(SEG_LEN), h_g(SEG_LEN);
+	for (int i = 0; i < SEG_LEN; ++i) {
+		h_w[i] = cos(0.3f * i);
+		h_g[i] = sin(0.7f * i);
+	}
+
+	ParsSegment seg;
+	seg.start = 0;
+	seg.len = SEG_LEN;
+	seg.lr = lr;
+	seg.grad_scale = 1;
+	seg.momentum = 0.9f;
+	seg.weight_decay = INIT_LR * DECAY_COEF;
+	seg.decay_coef = DECAY_COEF;
+	seg.step = 1;
+	seg.is_bias = 0;
+
+	float *w, *g;
+	ParsSegment *d_seg;
+	cudaMalloc((void**)&w, sizeof(float) * SEG_LEN);
+	cudaMalloc((void**)&g, sizeof(float) * SEG_LEN);
+	cudaMalloc((void**)&d_seg, sizeof(ParsSegment));
+	cudaMemcpy(w, &h_w[0], sizeof(float) * SEG_LEN, cudaMemcpyHostToDevice);
+	cudaMemcpy(g, &h_g[0], sizeof(float) * SEG_LEN, cudaMemcpyHostToDevice);
+	cudaMemcpy(d_seg, &seg, sizeof(ParsSegment), cudaMemcpyHostToDevice);
+
+	optimizer->createState(SEG_LEN);
+	optimizer->update(w, g, d_seg, 1, SEG_LEN);
+	cudaStreamSynchronize(cudaStreamPerThread);
+
+	delta.resize(SEG_LEN);
+	cudaMemcpy(&delta[0], w, sizeof(float) * SEG_LEN, cudaMemcpyDeviceToHost);
+	for (int i = 0; i < SEG_LEN; ++i)
+		delta[i] -= h_w[i];
+
+	cudaFree(w);
+	cudaFree(g);
+	cudaFree(d_seg);
+}
+
+static bool check(const string& name, Optimizer* optimizer) {
+	vector<float> delta, delta_small;
+	updateOnce(optimizer, INIT_LR, delta);
+	///> warmup第0个epoch的学习率
+	updateOnce(optimizer, INIT_LR / 8, delta_small);
+
+	float max_diff = 0;
+	for (int i = 0; i < SEG_LEN; ++i)
+		max_diff = max(max_diff, fabs(delta[i] / 8 - delta_small[i]));
+	cout << name << " max diff: " << max_diff << endl;
+	delete optimizer;
+	return max_diff < 1e-6;
+}
+
+int main() {
+	bool is_pass = true;
+	is_pass = check("adam", new AdamOptimizer(0.9f, 0.999f, 1e-8f)) && is_pass;
+	is_pass = check("adamw", new AdamWOptimizer(0.9f, 0.999f, 1e-8f)) && is_pass;
+	is_pass = check("rmsprop", new RMSPropOptimizer(0.9f, 1e-8f)) && is_pass;
+	is_pass = check("lars", new LarsOptimizer(0.001f)) && is_pass;
+	is_pass = check("lamb", new LambOptimizer(0.9f, 0.999f, 1e-6f)) && is_pass;
+
+	if (!is_pass) {
+		cout << "FAILED" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}
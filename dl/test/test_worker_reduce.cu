@@ -0,0 +1,129 @@
+///
+/// \file test_worker_reduce.cu
+/// \brief 几个worker各算minibatch的一段，更新后的参数要和一个worker算整个minibatch相同
+///
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include "train_classification.hpp"
+
+using namespace std;
+
+int Param::_minibatch_size = 0;
+
+#define NUM_TRAIN 8
+#define IMG_SIZE 4
+#define NUM_CLASS 3
+
+/// \brief 固定的一个minibatch，不读文件
+template <typename Dtype>
+class FixedLoad : public LoadLayer<Dtype> {
+
+public:
+	FixedLoad() : LoadLayer<Dtype>(NUM_TRAIN, 0, 0, IMG_SIZE, 1) {
+		for (int i = 0; i < NUM_TRAIN * IMG_SIZE * IMG_SIZE; ++i)
+			this->_train_pixel[i] = sin(0.37f * i);
+		for (int i = 0; i < NUM_TRAIN; ++i)
+			this->_train_label[i] = i % NUM_CLASS;
+	}
+
+	void loadTrainOneBatch(int batch_idx, Dtype* &mini_pixel, int* &mini_label) {
+		mini_pixel = this->_train_pixel;
+		mini_label = this->_train_label;
+	}
+};
+
+/// \brief 只是为了设置数据和读写主模型的参数
+class TestModel : public TrainClassification<float> {
+
+public:
+	TestModel() : TrainClassification<float>(false, false) {}
+
+	void setLoad() {
+		this->_load_layer = new FixedLoad<float>();
+		this->_model_component->_num_train = NUM_TRAIN;
+		this->_model_component->_num_valid = 0;
+		this->_model_component->setNumTrainBatch();
+		this->_model_component->setNumValidBatch();
+	}
+	void getPars(vector<float>& pars) {
+		pars.resize(this->_model_component->_pars_len);
+		this->_model_component->_pars->copyToHost(&pars[0], pars.size());
+	}
+	void setPars(vector<float>& pars) {
+		this->_model_component->_pars->copyFromHost(&pars[0], pars.size());
+	}
+};
+
+static string writeJson(const int num_worker, const int num_stage) {
+	stringstream ss;
+	ss << "/tmp/test_worker_reduce_" << num_worker << "_" << num_stage << ".json";
+	ofstream fout(ss.str().c_str());
+	fout << "{\"minibatch_size\": " << NUM_TRAIN << ", \"num_worker\": " << num_worker \
+		<< ", \"pipeline\": {\"num_stage\": " << num_stage << "}" \
+		<< ", \"num_epoch\": 1, \"img_height\": " << IMG_SIZE \
+		<< ", \"img_width\": " << IMG_SIZE << ", \"img_channel\": 1, \"layer\": [" \
+		<< "{\"type\": \"INNERPRODUCT\", \"name\": \"inner1\", \"num_out\": 8, " \
+		<< "\"w_lr\": 0.1, \"bias_lr\": 0.1, \"momentum\": 0.9, " \
+		<< "\"weight_decay\": 0, \"w_gauss\": 0.1}, " \
+		<< "{\"type\": \"RECTIFIED\", \"name\": \"relu1\"}, " \
+		<< "{\"type\": \"INNERPRODUCT\", \"name\": \"inner2\", \"num_out\": " \
+		<< NUM_CLASS << ", \"w_lr\": 0.1, \"bias_lr\": 0.1, \"momentum\": 0.9, " \
+		<< "\"weight_decay\": 0, \"w_gauss\": 0.1}, " \
+		<< "{\"type\": \"SOFTMAX\", \"name\": \"softmax\"}]}";
+	fout.close();
+	return ss.str();
+}
+
+/// 从init开始训练一个minibatch，返回更新后的参数，init为空时随机初始化并返回初值
+static void trainOneBatch(const int num_worker, const int num_stage, \
+		vector<float>& init, vector<float>& pars) {
+	TestModel *model = new TestModel();
+	model->parseNetJson(writeJson(num_worker, num_stage));
+	model->setLoad();
+	model->createLayer();
+	model->createWBias();
+	model->createPixelAndLabel();
+	model->createYDEDY();
+	if (init.empty()) {
+		model->initWeightByRandom();
+		model->getPars(init);
+	} else {
+		model->setPars(init);
+	}
+	model->createWorkers();
+	model->train();
+	model->getPars(pars);
+	delete model;
+}
+
+static bool check(const string& name, vector<float>& expect, vector<float>& pars) {
+	float max_diff = 0;
+	for (int i = 0; i < expect.size(); ++i)
+		max_diff = max(max_diff, fabs(expect[i] - pars[i]));
+	cout << name << " max diff: " << max_diff << endl;
+	return max_diff < 1e-5;
+}
+
+int main() {
+	vector<float> init, expect, pars;
+	trainOneBatch(1, 1, init, expect);
+
+	bool is_pass = true;
+	trainOneBatch(2, 1, init, pars);
+	is_pass = check("2 workers", expect, pars) && is_pass;
+	trainOneBatch(2, 2, init, pars);
+	is_pass = check("2 micro-batches, 2 stages", expect, pars) && is_pass;
+	trainOneBatch(4, 2, init, pars);
+	is_pass = check("4 micro-batches, 2 stages", expect, pars) && is_pass;
+
+	if (!is_pass) {
+		cout << "FAILED" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}